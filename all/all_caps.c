@@ -1,91 +1,146 @@
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-#define N 4  // Number of dimensions
+// The dimension is chosen at runtime (-n) up to N_MAX, which sizes the arrays below
+#ifndef N_MAX
+#define N_MAX 7
+#endif
 #define Q 3  // Size of the field
 
 #if Q == 3
-    #if N == 2
-        #define QN 9
-        #define MAX_DEPTH 5  // Must be at least one more than the size of a maximum cap set
-    #elif N == 3
-        #define QN 27
-        #define MAX_DEPTH 10
-    #elif N == 4
-        #define QN 81
-        #define MAX_DEPTH 21
-    #elif N == 5
-        #define QN 243
-        #define MAX_DEPTH 46
-    #elif N == 6
-        #define QN 729
-        #define MAX_DEPTH 113
-    #elif N == 7
-        #define QN 2187
-        #define MAX_DEPTH 337
+    #if N_MAX == 2
+        #define QN_MAX 9
+        #define DEPTH_MAX 5
+    #elif N_MAX == 3
+        #define QN_MAX 27
+        #define DEPTH_MAX 10
+    #elif N_MAX == 4
+        #define QN_MAX 81
+        #define DEPTH_MAX 21
+    #elif N_MAX == 5
+        #define QN_MAX 243
+        #define DEPTH_MAX 46
+    #elif N_MAX == 6
+        #define QN_MAX 729
+        #define DEPTH_MAX 113
+    #elif N_MAX == 7
+        #define QN_MAX 2187
+        #define DEPTH_MAX 337
     #endif
 #endif
 
-#define QN1 (QN/Q)
-#define ALPHA MIN(QN1, MAX_DEPTH)
-#define NORMALS ((QN-1)/2)  // This doesn't work for fields other than F_3
-#define HYPERPLANES (Q*NORMALS)
-#define MAXN (QN+HYPERPLANES)  // Size of point-hyperplane incidence graph
+#define QN1_MAX (QN_MAX/Q)
+#define ALPHA_MAX MIN(QN1_MAX, DEPTH_MAX)
+#define NORMALS_MAX ((QN_MAX-1)/2)  // This doesn't work for fields other than F_3
+#define HYPERPLANES_MAX (Q*NORMALS_MAX)
+#define MAXN (QN_MAX+HYPERPLANES_MAX)  // Size of the largest point-hyperplane incidence graph
 
 #include "nauty.h"
 
+// The sparse graph path (-g sparse) needs nausparse.h, which comes with nauty but is not vendored here:
+// compile with -I pointing at the headers of the same nauty 2.8.6 the program links against to enable it
+#ifdef __has_include
+#if __has_include("nausparse.h")
+#include "nausparse.h"
+#define HAVE_NAUSPARSE 1
+#endif
+#endif
+#ifndef HAVE_NAUSPARSE
+#define HAVE_NAUSPARSE 0
+#endif
+#include "../bitset.h"
+#include "../packed_card.h"
+#include "../third_table.h"
+
 #define MIN(a,b) (((a) < (b)) ? (a) : (b))
 #define PMOD(x, n) ((x % n + n) % n)
 
 // Element of Z_Q^n
-typedef char card[N];
+typedef char card[N_MAX];
 
-card cards[QN], normals[NORMALS];
+// Size of a maximum cap set plus one for every supported dimension
+int max_depths[8] = {0, 0, 5, 10, 21, 46, 113, 337};
+
+// Dimension parameters, set by init_params()
+int N;  // Number of dimensions
+int QN, QN1, MAX_DEPTH, ALPHA, NORMALS, HYPERPLANES;
+int NV, M;  // Size of point-hyperplane incidence graph and setwords per row
+
+card cards[QN_MAX], normals[NORMALS_MAX];
+packed_card codes[QN_MAX];
+const uint16_t* third_tab;  // NULL if third() is computed
 int setter[Q][Q];
 
-int cap[MAX_DEPTH], alpha[QN][ALPHA], invar_buff[MAXN];
-int point_hyp[QN][NORMALS], hyp_point[HYPERPLANES][QN1], cap_count[HYPERPLANES];
-bool in_cap[QN], elim[QN];
+int point_hyp[QN_MAX][NORMALS_MAX], hyp_point[HYPERPLANES_MAX][QN1_MAX];
 
-graph g[MAXN * MAXM], canon[MAXN * MAXM];
-int lab[MAXN], ptn[MAXN], orbit[MAX_DEPTH][MAXN];
+// The graph is only read once init() is done, so every search shares it.
+// Each point is on NORMALS hyperplanes, so the sparse form has 2 QN NORMALS entries instead of NV^2 bits,
+// and sparsenauty() refines it in time proportional to that (-g sparse).
+bool use_sparse = false;
+graph g[MAXN * MAXM];
 DEFAULTOPTIONS_GRAPH(options);
-statsblk stats;
+#if HAVE_NAUSPARSE
+SG_DECL(sg);
+DEFAULTOPTIONS_SPARSEGRAPH(sparse_options);
+#endif
+
+// orderly: every candidate that passes the invariants is labeled canonically.
+// augment: a candidate is accepted without a labeling when the group of the parent forces the choice (-e augment).
+// Both accept the same cap sets, so they give the same counts
+#define engine_orderly 0
+#define engine_augment 1
+int engine = engine_orderly;
+
+// State of one depth-first search: the cap set it is extending and the buffers nauty works in.
+// The serial search has a single one, and in parallel mode every worker has its own.
+typedef struct search_struct {
+    int cap[DEPTH_MAX], alpha[QN_MAX][ALPHA_MAX], cap_count[HYPERPLANES_MAX];
+    int invar[MAXN];  // Vertex invariant handed to nauty, kept up to date by add_card() and remove_card()
+    int pairs[QN_MAX];  // Number of pairs of cards in the cap that form a set with each card
+    uint64_t in_cap[BITSET_WORDS(QN_MAX)], elim[BITSET_WORDS(QN_MAX)];  // Bitsets of cards
+    graph canon[MAXN * MAXM];
+#if HAVE_NAUSPARSE
+    sparsegraph sparse_canon;  // Allocated by sparsenauty()
+#endif
+    int lab[MAXN], ptn[MAXN], orbit[DEPTH_MAX][MAXN];
+    statsblk stats;
+    unsigned long long cases[DEPTH_MAX], tots[DEPTH_MAX], comps[DEPTH_MAX];
+    unsigned long long grp_size;  // TODO implement biguint
+    unsigned long long labelings, skipped;  // Canonical labelings done, and skipped by the augment engine
+    int worker;  // Index of the worker running it, or -1 for the serial search
+} search;
 
-unsigned long long cases[MAX_DEPTH], tots[MAX_DEPTH], comps[MAX_DEPTH];
+// Search of the calling thread, for the nauty callbacks
+_Thread_local search* cur_search;
+
+// Totals over every search
+unsigned long long cases[DEPTH_MAX], tots[DEPTH_MAX], comps[DEPTH_MAX], labelings, skipped;
 
 // TODO implement biguint
-unsigned long long grp_size, glfqn_size;
+unsigned long long glfqn_size;
 
 void userlevelproc(
     int* lab, int* ptn, int level, int* orbits, statsblk* stats,
     int tv, int index, int tcellsize, int numcells, int childcount, int n
 ) {
     if (numcells == n)
-        grp_size = 1;
+        cur_search->grp_size = 1;
     else
-        grp_size *= index;
+        cur_search->grp_size *= index;
 }
 
+// The invariant of a point is the sum of alpha[i][j] * j^2 over j >= 1, negated for points in the cap,
+// and 0 for hyperplanes. alpha does not change during a nauty call, so it is kept in the search
 void invarproc(
     graph* g, int* lab, int* ptn, int level, int numcells, int tvpos,
     int* invar, int invararg, boolean digraph, int m, int n)
 {
-    // memset(invar, 0, sizeof(int) * MAXN);
-    int i, j;
-
-    for (i = 0; i < QN; i++) {
-        invar[i] = 0;
-        for (j = 1; j < ALPHA; j++)
-            invar[i] += alpha[i][j] * j * j;
-        if (in_cap[i])
-            invar[i] *= -1;
-        // else if (elim[i])
-        //     invar[i] *= 2;
-    }
-    for (i = QN; i < MAXN; i++)
-        invar[i] = 0;
+    memcpy(invar, cur_search->invar, n * sizeof(int));
 }
 
 // Returns the decimal value of a card interpreted in base-Q
@@ -99,12 +154,18 @@ int card_index(card c) {
 
 // Returns the index of the card that completes a set
 int third(int c1, int c2) {
+#if Q == 3
+    if (third_tab)
+        return third_tab[c1*QN + c2];
+    return packed_index(packed_third(codes[c1], codes[c2]), N);
+#else
     card res;
     int i;
 
     for (i = 0; i < N; i++)
-        res[i] = setter[cards[c1][i]][cards[c2][i]];
+        res[i] = setter[(int) cards[c1][i]][(int) cards[c2][i]];
     return card_index(res);
+#endif
 }
 
 bool vec_eq(int* v1, int* v2, int n) {
@@ -151,10 +212,27 @@ void print_data() {
         printf(" %3d | %20llu | %12llu | %12llu\n", i, tots[i], cases[i], comps[i]);
 }
 
+// Derives the dimension parameters from N
+void init_params() {
+    int i;
+
+    for (QN = 1, i = 0; i < N; i++)
+        QN *= Q;
+    QN1 = QN/Q;
+    MAX_DEPTH = max_depths[N];  // Must be at least one more than the size of a maximum cap set
+    ALPHA = MIN(QN1, MAX_DEPTH);
+    NORMALS = (QN-1)/2;  // This doesn't work for fields other than F_3
+    HYPERPLANES = Q*NORMALS;
+    NV = QN+HYPERPLANES;
+    M = SETWORDSNEEDED(NV);
+}
+
 void init() {
-    int i, j, k, hyp, hyp_ind[HYPERPLANES] = {0}, offset;
+    int i, j, k, hyp, hyp_ind[HYPERPLANES_MAX] = {0}, offset;
     card count = {0};
 
+    init_params();
+
     // Setters
     for (i = 0; i < Q; i++) {
         for (j = 0; j < Q; j++)
@@ -162,7 +240,12 @@ void init() {
     }
 
     // Card vectors
+    packed_init();
+#if Q == 3
+    third_tab = third_table_open(N);
+#endif
     for (i = 0; i < QN; i++) {
+        codes[i] = packed_from_index(i);
         for (j = 0; j < N; j++)
             cards[i][j] = count[j];
         for (j = 0; j < N; j++) {
@@ -182,8 +265,8 @@ void init() {
     }
 
     // Affine point-hyperplane incidence graph
-    nauty_check(WORDSIZE, MAXM, MAXN, NAUTYVERSIONID);
-    EMPTYGRAPH(g, MAXM, MAXN);
+    nauty_check(WORDSIZE, M, NV, NAUTYVERSIONID);
+    EMPTYGRAPH(g, M, NV);
 
     for (i = 0; i < QN; i++) {
         for (j = 0; j < NORMALS; j++) {
@@ -191,166 +274,573 @@ void init() {
             for (k = 0; k < N; k++)
                 offset += normals[j][k] * cards[i][k];
             hyp = Q*j + PMOD(offset, Q);
-            ADDONEEDGE(g, i, hyp + QN, MAXM);
+            ADDONEEDGE(g, i, hyp + QN, M);
             point_hyp[i][j] = hyp;
             hyp_point[hyp][hyp_ind[hyp]] = i;
             hyp_ind[hyp]++;
         }
     }
 
+#if HAVE_NAUSPARSE
+    // The same graph in sparse form: the neighbours of vertex v are sg.e[sg.v[v] .. sg.v[v] + sg.d[v])
+    if (use_sparse) {
+        SG_ALLOC(sg, NV, 2 * QN * NORMALS, "init");
+        sg.nv = NV;
+        sg.nde = 2 * QN * NORMALS;
+        for (i = 0; i < QN; i++) {
+            sg.v[i] = (size_t) i * NORMALS;
+            sg.d[i] = NORMALS;
+            for (j = 0; j < NORMALS; j++)
+                sg.e[sg.v[i] + j] = point_hyp[i][j] + QN;
+        }
+        for (hyp = 0; hyp < HYPERPLANES; hyp++) {
+            sg.v[QN + hyp] = (size_t) QN * NORMALS + (size_t) hyp * QN1;
+            sg.d[QN + hyp] = QN1;
+            for (j = 0; j < QN1; j++)
+                sg.e[sg.v[QN + hyp] + j] = hyp_point[hyp][j];
+        }
+    }
+#endif
+
+    // nauty options
+    options.defaultptn = FALSE;
+    options.getcanon = TRUE;
+    options.userlevelproc = &userlevelproc;
+    options.invarproc = &invarproc;
+#if HAVE_NAUSPARSE
+    sparse_options.defaultptn = FALSE;
+    sparse_options.getcanon = TRUE;
+    sparse_options.userlevelproc = &userlevelproc;
+    sparse_options.invarproc = &invarproc;
+#endif
+}
+
+// Returns an empty search (free it with search_free())
+search* search_alloc(int worker) {
+    search* s = (search*) calloc(1, sizeof(search));
+
+    s->worker = worker;
+    return s;
+}
+
+void search_free(search* s) {
+#if HAVE_NAUSPARSE
+    SG_FREE(s->sparse_canon);
+#endif
+    free(s);
+}
+
+// Canonically labels the incidence graph colored by lab and ptn,
+// leaving the canonical labeling in lab and writing the orbits of its automorphism group to orbits
+void canon_label(search* s, int* orbits) {
+#if HAVE_NAUSPARSE
+    if (use_sparse) {
+        sparsenauty(&sg, s->lab, s->ptn, orbits, &sparse_options, &s->stats, &s->sparse_canon);
+        return;
+    }
+#endif
+    densenauty(g, s->lab, s->ptn, orbits, &options, &s->stats, M, NV, s->canon);
+}
+
+// Empties the cap set of a search, keeping its counters
+void search_reset(search* s) {
+    int i;
+
+    memset(s->alpha, 0, sizeof(s->alpha));
+    memset(s->invar, 0, sizeof(s->invar));
+    memset(s->pairs, 0, sizeof(s->pairs));
+    memset(s->cap_count, 0, sizeof(s->cap_count));
+    bitset_clear(s->in_cap, QN);
+    bitset_clear(s->elim, QN);
+
     // alpha
     for (i = 0; i < QN; i++)
-        alpha[i][0] = NORMALS;
+        s->alpha[i][0] = NORMALS;
 
     // Labeling
-    for (i = 0; i < MAXN; i++)
-        lab[i] = i;
+    for (i = 0; i < NV; i++)
+        s->lab[i] = i;
 
     // Coloring
-    for (i = 0; i < MAXN-1; i++)
-        ptn[i] = 1;
-    ptn[MAXN-1] = 0;
+    for (i = 0; i < NV-1; i++)
+        s->ptn[i] = 1;
+    s->ptn[NV-1] = 0;
+}
 
-    // nauty options
-    options.defaultptn = FALSE;
-    options.getcanon = TRUE;
-    options.userlevelproc = &userlevelproc;
-    options.invarproc = &invarproc;
+// Adds cap[lvl] to the cap set and increments the hyperplane intersections
+void add_card(search* s, int lvl) {
+    int j, k, l, p, rep = s->cap[lvl];
+
+    for (j = 0; j < lvl; j++)
+        s->pairs[third(rep, s->cap[j])]++;
+    bitset_set(s->in_cap, rep);
+    s->invar[rep] = -s->invar[rep];
+    for (j = 0; j < NORMALS; j++) {
+        l = s->cap_count[point_hyp[rep][j]]++;
+        for (k = 0; k < QN1; k++) {
+            p = hyp_point[point_hyp[rep][j]][k];
+            s->alpha[p][l]--;
+            s->alpha[p][l+1]++;
+
+            // A hyperplane meets a cap in fewer than ALPHA cards, so l+1 is always counted in the invariant
+            s->invar[p] += bitset_test(s->in_cap, p) ? -(2*l + 1) : 2*l + 1;
+        }
+    }
 }
 
-int itrs = 0;
+// Removes cap[lvl] from the cap set and decrements the hyperplane intersections
+void remove_card(search* s, int lvl) {
+    int j, k, l, p, rep = s->cap[lvl];
+
+    for (j = 0; j < lvl; j++)
+        s->pairs[third(rep, s->cap[j])]--;
+    bitset_reset(s->in_cap, rep);
+    s->invar[rep] = -s->invar[rep];
+    for (j = 0; j < NORMALS; j++) {
+        l = s->cap_count[point_hyp[rep][j]]--;
+        for (k = 0; k < QN1; k++) {
+            p = hyp_point[point_hyp[rep][j]][k];
+            s->alpha[p][l]--;
+            s->alpha[p][l-1]++;
+            s->invar[p] += bitset_test(s->in_cap, p) ? 2*l - 1 : -(2*l - 1);
+        }
+    }
+}
 
-void orderly(int lvl) {
-    if (lvl == MAX_DEPTH) return;
+// Returns the sum over the other cards c of cap[0..lvl] of the number of pairs of the cap that form a set
+// with the third card of p and c. Like alpha it does not depend on how the cap is labeled,
+// and it separates many of the cards that alpha ties
+int pair_weight(const search* s, int lvl, int p) {
+    int j, res = 0;
 
-    int i, j, k, l, cand[QN] = {0}, orbs = 0, rep;
-    bool seen[QN] = {false}, max_alpha;
+    for (j = 0; j <= lvl; j++) {
+        if (s->cap[j] != p)
+            res += s->pairs[third(p, s->cap[j])];
+    }
+    return res;
+}
 
-    tots[lvl] += glfqn_size / grp_size;
-    cases[lvl]++;
+// Adds the counters of a search to the totals
+void merge_counts(const search* s) {
+    int i;
 
-    for (i = 0; i < QN; i++) {
-        rep = orbit[lvl][i];
-        
-        // Only consider unique uneliminated orbit representatives 
-        if (seen[rep] || elim[rep]) continue;
-        seen[rep] = true;
-
-        cand[orbs] = rep;
-        orbs++;
+    for (i = 0; i < MAX_DEPTH; i++) {
+        cases[i] += s->cases[i];
+        tots[i] += s->tots[i];
+        comps[i] += s->comps[i];
     }
+    labelings += s->labelings;
+    skipped += s->skipped;
+}
 
-    for (i = 0; i < orbs; i++) {
-        int unelim[QN] = {0};
+/*
+Parallel mode (-j threads): the subtree below every accepted cap set of size split_level (-s)
+becomes a task, and a pool of workers runs the tasks, each with a search of its own.
+
+A task holds just enough to restart the search at its node: the cap set, the orbits of the cards
+under its stabilizer and the order of the stabilizer (the eliminated cards and alpha follow from the cap set).
+Every worker has a deque of tasks. It pushes the tasks it finds and pops them from the same end,
+so it goes on depth-first in the part of the tree it knows, and an idle worker steals from the other end
+of another worker's deque, which holds the oldest tasks and so the ones highest up in the tree.
+The search starts as a single task at the root, and workers sleep while there is nothing to steal.
+
+nauty keeps its workspace in static arrays, so parallel mode needs nauty built with thread-local storage
+(compile with -DUSE_TLS and link nautyT.a).
+*/
+
+typedef struct task_struct {
+    int lvl;  // Size of the cap set
+    unsigned long long grp_size;
+    int cap[DEPTH_MAX], orbit[QN_MAX];
+} task;
+
+typedef struct deque_struct {
+    pthread_mutex_t lock;
+    task** tasks;
+    int head, tail, size;  // tasks[head..tail) are queued; the owner works at the tail and thieves at the head
+} deque;
+
+int num_threads = 1, split_level = 5;
+deque* deques;
+atomic_int queued, pending;  // Tasks waiting in a deque, and tasks not finished yet
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;  // Signaled when a task is queued or the last one is done
+
+atomic_int itrs;
+
+// Queues the node of a search with a cap set of size lvl on the deque of worker w
+void push_task(const search* s, int lvl, int w) {
+    task* t = (task*) malloc(sizeof(task));
+    deque* d = deques + w;
+
+    t->lvl = lvl;
+    t->grp_size = s->grp_size;
+    memcpy(t->cap, s->cap, lvl * sizeof(int));
+    memcpy(t->orbit, s->orbit[lvl], QN * sizeof(int));
+    atomic_fetch_add(&pending, 1);
+
+    pthread_mutex_lock(&d->lock);
+    if (d->tail == d->size) {
+        if (d->head > 0) {
+            memmove(d->tasks, d->tasks + d->head, (d->tail - d->head) * sizeof(task*));
+            d->tail -= d->head;
+            d->head = 0;
+        } else {
+            d->size = d->size == 0 ? 64 : 2 * d->size;
+            d->tasks = (task**) realloc(d->tasks, d->size * sizeof(task*));
+        }
+    }
+    d->tasks[d->tail++] = t;
+    pthread_mutex_unlock(&d->lock);
 
-        rep = cand[i];
-        cap[lvl] = rep;
-        in_cap[rep] = true;
+    atomic_fetch_add(&queued, 1);
+    pthread_mutex_lock(&pool_lock);
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+}
 
-        // Increment hyperplane intersections
-        for (j = 0; j < NORMALS; j++) {
-            l = cap_count[point_hyp[rep][j]]++;
-            for (k = 0; k < QN1; k++) {
-                alpha[hyp_point[point_hyp[rep][j]][k]][l]--;
-                alpha[hyp_point[point_hyp[rep][j]][k]][l+1]++;
-            }
+// Pops the newest task of worker w, or else steals the oldest task of another worker (NULL if every deque is empty)
+task* take_task(int w) {
+    task* t = NULL;
+    deque* d;
+    int i;
+
+    for (i = 0; i < num_threads && !t; i++) {
+        d = deques + (w + i) % num_threads;
+        pthread_mutex_lock(&d->lock);
+        if (d->head < d->tail)
+            t = i == 0 ? d->tasks[--d->tail] : d->tasks[d->head++];
+        if (d->head == d->tail)
+            d->head = d->tail = 0;
+        pthread_mutex_unlock(&d->lock);
+    }
+    if (t)
+        atomic_fetch_sub(&queued, 1);
+    return t;
+}
+
+// Returns the next task for worker w, waiting for one if needed, or NULL once every task is done
+task* next_task(int w) {
+    task* t;
+
+    for (;;) {
+        if ((t = take_task(w)))
+            return t;
+        pthread_mutex_lock(&pool_lock);
+        while (atomic_load(&queued) == 0 && atomic_load(&pending) > 0)
+            pthread_cond_wait(&pool_cond, &pool_lock);
+        pthread_mutex_unlock(&pool_lock);
+        if (atomic_load(&pending) == 0)
+            return NULL;
+    }
+}
+
+// Marks a task as done, waking every worker if it was the last one
+void finish_task(task* t) {
+    free(t);
+    if (atomic_fetch_sub(&pending, 1) == 1) {
+        pthread_mutex_lock(&pool_lock);
+        pthread_cond_broadcast(&pool_cond);
+        pthread_mutex_unlock(&pool_lock);
+    }
+}
+
+// Sets a search to the node of a task
+void search_load(search* s, const task* t) {
+    int i, j;
+
+    search_reset(s);
+    for (i = 0; i < t->lvl; i++) {
+        s->cap[i] = t->cap[i];
+        add_card(s, i);
+
+        // Eliminate the card and the cards that form a set with it and an earlier card
+        bitset_set(s->elim, t->cap[i]);
+        for (j = 0; j < i; j++)
+            bitset_set(s->elim, third(t->cap[j], t->cap[i]));
+    }
+    memcpy(s->orbit[t->lvl], t->orbit, QN * sizeof(int));
+    s->grp_size = t->grp_size;
+}
+
+// Prints an accepted cap set as its number, its size minus one as dots and the card added
+// (as one write, so that lines from different workers do not mix)
+void print_node(int lvl, int rep) {
+    char line[DEPTH_MAX + 32];
+    int len;
+
+    len = sprintf(line, "%9d ", atomic_fetch_add(&itrs, 1) + 1);
+    memset(line + len, '.', lvl);
+    sprintf(line + len + lvl, "%d (%d)\n", rep, lvl + 1);
+    fputs(line, stdout);
+}
+
+void orderly(search* s, int lvl);
+
+// Goes on from an accepted cap set cap[0..lvl], whose automorphism group is in orbit[lvl+1] and grp_size
+void extend(search* s, int lvl) {
+    int j, k, l = 0, rep = s->cap[lvl], unelim[DEPTH_MAX];
+
+    print_node(lvl, rep);
+
+    if (s->worker >= 0 && lvl + 1 == split_level) {
+        // Leave the subtree to whichever worker gets to it
+        push_task(s, lvl + 1, s->worker);
+        return;
+    }
+
+    // Eliminate cards that form a set with rep and another card in the cap
+    for (j = 0; j <= lvl; j++) {
+        k = third(rep, s->cap[j]);
+        if (!bitset_test(s->elim, k)) {
+            bitset_set(s->elim, k);
+            unelim[l] = k;
+            l++;
+        }
+    }
+
+    orderly(s, lvl + 1);
+
+    // Uneliminate cards
+    for (j = 0; j < l; j++)
+        bitset_reset(s->elim, unelim[j]);
+}
+
+// Returns the number of cards in the orbit of card p under the automorphism group of cap[0..lvl-1]
+int orbit_size(const search* s, int lvl, int p) {
+    int i, res = 0;
+
+    for (i = 0; i < QN; i++)
+        res += s->orbit[lvl][i] == s->orbit[lvl][p];
+    return res;
+}
+
+void orderly(search* s, int lvl) {
+    if (lvl == MAX_DEPTH) return;
+
+    int i, j, k, cand[QN], orbs = 0, rep, weight;
+    uint64_t avail[BITSET_WORDS(QN)];
+    unsigned long long parent_size = s->grp_size;  // The labelings below overwrite grp_size
+    bool maximal, tied;
+
+    s->tots[lvl] += glfqn_size / parent_size;
+    s->cases[lvl]++;
+
+    // Only consider unique uneliminated orbit representatives: nauty numbers each orbit by its smallest card,
+    // and the eliminated cards are a union of orbits, so these are the uneliminated cards that number their orbit
+    bitset_fill(avail, QN);
+    bitset_andnot(avail, s->elim, QN);
+    for (i = bitset_next(avail, QN, 0); i >= 0; i = bitset_next(avail, QN, i+1)) {
+        if (s->orbit[lvl][i] == i) {
+            cand[orbs] = i;
+            orbs++;
         }
+    }
 
-        // Check that alpha(rep) is maximal
-        max_alpha = true;
-        for (j = 0; j < lvl; j++) {
-            if (!vec_geq(alpha[rep], alpha[cap[j]], ALPHA)) {
-                max_alpha = false;
-                break;
+    for (i = 0; i < orbs; i++) {
+        rep = cand[i];
+        s->cap[lvl] = rep;
+        add_card(s, lvl);
+
+        // Check that (alpha(rep), pair_weight(rep)) is maximal, before paying for a canonical labeling
+        maximal = true;
+        tied = false;  // Whether another card has the same alpha and pair weight
+        weight = -1;  // pair_weight(rep), computed once some card ties with rep on alpha
+        for (j = 0; j < lvl && maximal; j++) {
+            if (!vec_geq(s->alpha[rep], s->alpha[s->cap[j]], ALPHA)) {
+                maximal = false;
+            } else if (vec_eq(s->alpha[rep], s->alpha[s->cap[j]], ALPHA)) {
+                if (weight < 0)
+                    weight = pair_weight(s, lvl, rep);
+                k = pair_weight(s, lvl, s->cap[j]);
+                if (k > weight)
+                    maximal = false;
+                else if (k == weight)
+                    tied = true;
             }
         }
-        
-        if (max_alpha) {
+
+        if (maximal && engine == engine_augment && !tied && parent_size <= (unsigned long long) QN
+            && orbit_size(s, lvl, rep) == (int) parent_size) {
+            // The choice is forced: rep is the only card of X + rep with maximal invariants,
+            // so every automorphism of X + rep fixes it and theta(X + rep) = rep.
+            // The group of X + rep is then the stabilizer of rep in the group of X, which is trivial
+            // since the orbit of rep is as large as the group, so every orbit is a single card
+            for (j = 0; j < QN; j++)
+                s->orbit[lvl+1][j] = j;
+            s->grp_size = 1;
+            s->skipped++;
+            extend(s, lvl);
+        } else if (maximal) {
             // Initialize labeling and coloring
-            for (j = QN; j < MAXN; j++)
-                lab[j] = j;
-            for (j = QN; j < MAXN-1; j++)
-                ptn[j] = 1;
-            ptn[MAXN-1] = 0;
+            for (j = QN; j < NV; j++)
+                s->lab[j] = j;
+            for (j = QN; j < NV-1; j++)
+                s->ptn[j] = 1;
+            s->ptn[NV-1] = 0;
             k = 0;
             for (j = 0; j < QN; j++) {
-                if (in_cap[j]) {
-                    lab[j] = lab[k];
-                    lab[k] = j;
+                if (bitset_test(s->in_cap, j)) {
+                    s->lab[j] = s->lab[k];
+                    s->lab[k] = j;
                     k++;
                 } else {
-                    lab[j] = j;
+                    s->lab[j] = j;
                 }
-                ptn[j] = 1;
+                s->ptn[j] = 1;
             }
-            ptn[lvl] = 0;
+            s->ptn[lvl] = 0;
 
-            densenauty(g, lab, ptn, orbit[lvl+1], &options, &stats, MAXM, MAXN, canon);
+            canon_label(s, s->orbit[lvl+1]);
+            s->labelings++;
 
             // Check if rep is in theta(X + rep)
             for (j = 0; j < QN; j++) {
-                // If lab[j] is the point in the cap with the least canonical label of those with maximal alpha,
-                // then lab[j] is a representative of theta(X + rep) and we break regardless
-                if (in_cap[lab[j]] && vec_eq(alpha[rep], alpha[lab[j]], ALPHA)) {
+                // If lab[j] is the point in the cap with the least canonical label of those with maximal alpha
+                // and pair weight, then lab[j] is a representative of theta(X + rep) and we break regardless
+                // (if no other card ties with rep on alpha, rep is the only one)
+                if (bitset_test(s->in_cap, s->lab[j]) && vec_eq(s->alpha[rep], s->alpha[s->lab[j]], ALPHA)
+                    && (s->lab[j] == rep || pair_weight(s, lvl, s->lab[j]) == weight)) {
                     // If rep is in the same orbit as lab[j]
-                    if (orbit[lvl+1][lab[j]] == orbit[lvl+1][rep]) {
-                        printf("%9d ", ++itrs);
-                        for (k = 0; k < lvl; k++)
-                            printf(".");
-                        printf("%d (%d)\n", rep, lvl + 1);
-
-                        // Eliminate cards that form a set with rep and another card in the cap
-                        l = 0;
-                        for (j = 0; j <= lvl; j++) {
-                            k = third(rep, lab[j]);
-                            if (!elim[k]) {
-                                elim[k] = true;
-                                unelim[l] = k;
-                                l++;
-                            }
-                        }
-
-                        orderly(lvl + 1);
-                        
-                        // Uneliminate cards
-                        for (j = 0; j < l; j++)
-                            elim[unelim[j]] = 0;
-                    }
+                    if (s->orbit[lvl+1][s->lab[j]] == s->orbit[lvl+1][rep])
+                        extend(s, lvl);
                     break;
                 }
             }
         }
 
-        in_cap[rep] = false;
-
-        // Decrement hyperplane intersections
-        for (j = 0; j < NORMALS; j++) {
-            l = cap_count[point_hyp[rep][j]]--;
-            for (k = 0; k < QN1; k++) {
-                alpha[hyp_point[point_hyp[rep][j]][k]][l]--;
-                alpha[hyp_point[point_hyp[rep][j]][k]][l-1]++;
-            }
-        }
+        remove_card(s, lvl);
     }
 
     if (orbs == 0)
-        comps[lvl]++;
+        s->comps[lvl]++;
+}
+
+void* run_worker(void* arg) {
+    search* s = (search*) arg;
+    task* t;
+
+    cur_search = s;
+    while ((t = next_task(s->worker))) {
+        search_load(s, t);
+        orderly(s, t->lvl);
+        finish_task(t);
+    }
+    return NULL;
 }
 
 void all_caps() {
-    densenauty(g, lab, ptn, orbit[0], &options, &stats, MAXM, MAXN, canon);
-    glfqn_size = grp_size;
-    orderly(0);
+    search* root = search_alloc(-1), ** searches;
+    pthread_t* threads;
+    int i;
+
+    search_reset(root);
+    cur_search = root;
+    canon_label(root, root->orbit[0]);
+    glfqn_size = root->grp_size;
+
+    if (num_threads == 1) {
+        orderly(root, 0);
+        merge_counts(root);
+        search_free(root);
+        return;
+    }
+
+    deques = (deque*) calloc(num_threads, sizeof(deque));
+    searches = (search**) malloc(num_threads * sizeof(search*));
+    threads = (pthread_t*) malloc(num_threads * sizeof(pthread_t));
+    for (i = 0; i < num_threads; i++) {
+        pthread_mutex_init(&deques[i].lock, NULL);
+        searches[i] = search_alloc(i);
+    }
+    push_task(root, 0, 0);
+    search_free(root);
+
+    // The main thread is worker 0
+    for (i = 1; i < num_threads; i++)
+        pthread_create(threads + i, NULL, run_worker, searches[i]);
+    run_worker(searches[0]);
+    for (i = 1; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    for (i = 0; i < num_threads; i++) {
+        merge_counts(searches[i]);
+        pthread_mutex_destroy(&deques[i].lock);
+        free(deques[i].tasks);
+        search_free(searches[i]);
+    }
+    free(deques);
+    free(searches);
+    free(threads);
 }
 
-int main() {
-    clock_t start;
+double wall_time() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+    double start;
+    int i;
+    bool bad_args = false, split_given = false;
+
+    N = 4;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i+1 < argc) {
+            N = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-j") == 0 && i+1 < argc) {
+            num_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i+1 < argc) {
+            split_level = atoi(argv[++i]);
+            split_given = true;
+        } else if (strcmp(argv[i], "-g") == 0 && i+1 < argc && strcmp(argv[i+1], "dense") == 0) {
+            use_sparse = false;
+            i++;
+        } else if (strcmp(argv[i], "-g") == 0 && i+1 < argc && strcmp(argv[i+1], "sparse") == 0) {
+            use_sparse = true;
+            i++;
+        } else if (strcmp(argv[i], "-e") == 0 && i+1 < argc && strcmp(argv[i+1], "orderly") == 0) {
+            engine = engine_orderly;
+            i++;
+        } else if (strcmp(argv[i], "-e") == 0 && i+1 < argc && strcmp(argv[i+1], "augment") == 0) {
+            engine = engine_augment;
+            i++;
+        } else {
+            bad_args = true;
+        }
+    }
+    if (!bad_args && N >= 2 && N <= N_MAX && !split_given && split_level >= max_depths[N])
+        split_level = max_depths[N] - 1;
+    if (bad_args || N < 2 || N > N_MAX || num_threads < 1 || split_level < 1 || split_level >= max_depths[N]) {
+        fprintf(stderr, "Usage: %s [-n dimension] [-j threads] [-s split_level] [-g dense|sparse] [-e orderly|augment]\n"
+            "(2 <= dimension <= %d, 1 <= split_level < 1 + size of a maximum cap set)\n", argv[0], N_MAX);
+        return 1;
+    }
+#if !HAVE_TLS
+    if (num_threads > 1) {
+        fprintf(stderr, "Running on several threads needs nauty built with -DUSE_TLS\n");
+        return 1;
+    }
+#endif
+#if !HAVE_NAUSPARSE
+    if (use_sparse) {
+        fprintf(stderr, "The sparse graph needs nausparse.h from nauty on the include path\n");
+        return 1;
+    }
+#endif
 
-    printf("Initializing...\n");
+    printf("Initializing (N=%d, %s graph, %s engine)...\n", N, use_sparse ? "sparse" : "dense",
+        engine == engine_augment ? "augment" : "orderly");
     init();
-    printf("Finding all caps...\n");
-    start = clock();
+    if (num_threads == 1)
+        printf("Finding all caps...\n");
+    else
+        printf("Finding all caps on %d threads (tasks of size %d)...\n", num_threads, split_level);
+    start = wall_time();
     all_caps();
-    printf("\nTime elapsed: %.5fs\n\n", (double) (clock() - start) / CLOCKS_PER_SEC);
+    printf("\nTime elapsed: %.5fs\n", wall_time() - start);
+    printf("Canonical labelings: %llu (%llu skipped)\n\n", labelings, skipped);
     print_data();
-}
\ No newline at end of file
+}
@@ -0,0 +1,92 @@
+/*
+Sets of cards as bitsets, shared by greedy_cap_sets.c and all/all_caps.c.
+
+Bit i of word i/64 is set if card i is in the set, so the 3^n cards of n=8 take 824 bytes.
+The number of words is rounded up to a multiple of 4 (256 bits) and bitset_alloc() aligns them
+to 32 bytes, so the bulk operations below are whole AVX2 vectors when the compiler vectorizes them.
+Bits past the last card are always kept clear, so they never show up in iteration.
+*/
+
+#ifndef BITSET_H
+#define BITSET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of words of a bitset holding the given number of bits
+#define BITSET_WORDS(bits) ((((bits) + 255) / 256) * 4)
+
+// Returns an empty bitset for the given number of bits (free it with free())
+static inline uint64_t* bitset_alloc(int bits) {
+    uint64_t* res = (uint64_t*) aligned_alloc(32, BITSET_WORDS(bits) * sizeof(uint64_t));
+
+    memset(res, 0, BITSET_WORDS(bits) * sizeof(uint64_t));
+    return res;
+}
+
+static inline bool bitset_test(const uint64_t* b, int i) {
+    return (b[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void bitset_set(uint64_t* b, int i) {
+    b[i >> 6] |= 1ULL << (i & 63);
+}
+
+static inline void bitset_reset(uint64_t* b, int i) {
+    b[i >> 6] &= ~(1ULL << (i & 63));
+}
+
+// Empties a bitset
+static inline void bitset_clear(uint64_t* b, int bits) {
+    memset(b, 0, BITSET_WORDS(bits) * sizeof(uint64_t));
+}
+
+// Sets every bit below bits
+static inline void bitset_fill(uint64_t* b, int bits) {
+    int i, full = bits >> 6, words = BITSET_WORDS(bits);
+
+    // One pass over all the words, so the compiler sees every one of them written
+    for (i = 0; i < words; i++)
+        b[i] = i < full ? ~0ULL : i == full ? (1ULL << (bits & 63)) - 1 : 0;
+}
+
+// dst = dst & ~src
+static inline void bitset_andnot(uint64_t* dst, const uint64_t* src, int bits) {
+    int i, words = BITSET_WORDS(bits);
+
+    for (i = 0; i < words; i++)
+        dst[i] &= ~src[i];
+}
+
+// Returns the smallest bit set at or after i, or -1 if there is none, so that the set bits are visited with
+//     for (i = bitset_next(b, bits, 0); i >= 0; i = bitset_next(b, bits, i+1))
+static inline int bitset_next(const uint64_t* b, int bits, int i) {
+    int k = i >> 6, words = (bits + 63) >> 6;
+    uint64_t w;
+
+    if (i >= bits)
+        return -1;
+    w = b[k] & (~0ULL << (i & 63));
+    while (w == 0) {
+        if (++k >= words)
+            return -1;
+        w = b[k];
+    }
+    return (k << 6) + __builtin_ctzll(w);
+}
+
+// Writes the set bits to out in increasing order, returning how many there are
+static inline int bitset_to_array(const uint64_t* b, int bits, int* out) {
+    int k, len = 0, words = (bits + 63) >> 6;
+    uint64_t w;
+
+    for (k = 0; k < words; k++) {
+        for (w = b[k]; w != 0; w &= w - 1)
+            out[len++] = (k << 6) + __builtin_ctzll(w);
+    }
+    return len;
+}
+
+#endif
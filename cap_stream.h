@@ -0,0 +1,328 @@
+/*
+Compact binary stream of every cap set produced by a run, and a memory-mapped reader for it.
+
+Each cap set is stored as its sorted card indices, delta-coded as LEB128 varints
+(the length first, then the first index, then the gaps), which is about one byte per card
+since the gaps between the cards of a cap set average 3^n / a_n.
+Cap sets are grouped in chunks of consecutive trials, which is how workers claim trials,
+so chunks land in the file in whatever order the workers finish them.
+
+File layout (all integers in native byte order):
+    cap_stream_header                   n, seed and the range of trials of the run
+    chunk data                          the encoded cap sets of each chunk, back to back
+    padding                             zeros up to a multiple of 8 bytes
+    cap_stream_chunk[chunk_count]       index of the chunks, sorted by first trial
+    cap_stream_footer                   where the index starts and how long it is
+
+The padding keeps the index and footer 8-byte aligned, so the reader uses them in place in the mapping.
+
+Workers hand finished chunks to cap_stream_put(), which only copies them into a buffer.
+A background thread writes the buffers out: while it writes one, workers fill the other,
+so a worker only waits on the disk if it gets a whole buffer ahead of it.
+*/
+
+#ifndef CAP_STREAM_H
+#define CAP_STREAM_H
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CAP_STREAM_MAGIC "CAPS"
+#define CAP_STREAM_INDEX_MAGIC "CAPI"
+#define CAP_STREAM_VERSION 2
+#define CAP_STREAM_BUF_SIZE (1 << 22)
+
+// Upper bound on the encoded size of a cap set with len cards
+#define CAP_STREAM_MAX_BYTES(len) (5 * ((len) + 1))
+
+typedef struct cap_stream_header_struct {
+    char magic[4];
+    uint32_t version, n, reserved;
+    uint64_t seed;
+    uint32_t first_trial, trials;
+} cap_stream_header;
+
+typedef struct cap_stream_chunk_struct {
+    uint32_t first_trial, count;
+    uint64_t offset;  // From the start of the file
+} cap_stream_chunk;
+
+typedef struct cap_stream_footer_struct {
+    uint64_t index_offset;
+    uint32_t chunk_count;
+    char magic[4];
+} cap_stream_footer;
+
+typedef struct cap_stream_struct {
+    FILE* fptr;
+    cap_stream_header header;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint8_t* buf[2];
+    size_t buf_len[2], buf_cap[2];
+    int active;  // Buffer that chunks are copied into
+    bool flushing, closing;  // flushing: the other buffer is being written
+    uint64_t offset;  // File offset of the next byte put
+    cap_stream_chunk* index;
+    int index_len, index_cap;
+} cap_stream;
+
+typedef struct cap_reader_struct {
+    const uint8_t* data;
+    size_t size;
+    const cap_stream_header* header;
+    const cap_stream_chunk* index;
+    int chunk_count;
+} cap_reader;
+
+static inline uint8_t* cap_stream_put_varint(uint8_t* p, uint32_t x) {
+    while (x >= 0x80) {
+        *p++ = (uint8_t) (x | 0x80);
+        x >>= 7;
+    }
+    *p++ = (uint8_t) x;
+    return p;
+}
+
+static inline const uint8_t* cap_stream_get_varint(const uint8_t* p, uint32_t* x) {
+    int shift = 0;
+
+    *x = 0;
+    do {
+        *x |= (uint32_t) (*p & 0x7f) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+    return p;
+}
+
+// Encodes a cap set whose cards are sorted in increasing order into dst
+// (which must have room for CAP_STREAM_MAX_BYTES(len) bytes), returning the number of bytes written
+static int cap_stream_encode(uint8_t* dst, const int* cap, int len) {
+    uint8_t* p = cap_stream_put_varint(dst, len);
+    int i, prev = 0;
+
+    for (i = 0; i < len; i++) {
+        p = cap_stream_put_varint(p, cap[i] - prev);
+        prev = cap[i];
+    }
+    return p - dst;
+}
+
+// Decodes one cap set into out (NULL to skip it), returning the position of the next one
+static const uint8_t* cap_stream_decode(const uint8_t* p, int* out, int* len) {
+    uint32_t l, d;
+    int i, prev = 0;
+
+    p = cap_stream_get_varint(p, &l);
+    for (i = 0; i < (int) l; i++) {
+        p = cap_stream_get_varint(p, &d);
+        prev += d;
+        if (out)
+            out[i] = prev;
+    }
+    *len = l;
+    return p;
+}
+
+static void* cap_stream_writer(void* arg) {
+    cap_stream* s = (cap_stream*) arg;
+    int other;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        while (!s->flushing && !s->closing)
+            pthread_cond_wait(&s->cond, &s->lock);
+        if (!s->flushing)
+            break;
+        other = 1 - s->active;
+        pthread_mutex_unlock(&s->lock);
+        fwrite(s->buf[other], 1, s->buf_len[other], s->fptr);
+        pthread_mutex_lock(&s->lock);
+        s->buf_len[other] = 0;
+        s->flushing = false;
+        pthread_cond_broadcast(&s->cond);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+// Creates the stream file for trials [first_trial, first_trial + trials) of a run
+// and starts its writer thread, returning -1 if the file cannot be created
+static int cap_stream_open(cap_stream* s, const char* path, int n, uint64_t seed, int first_trial, int trials) {
+    cap_stream_header* h = &s->header;
+    int i;
+
+    s->fptr = fopen(path, "wb");
+    if (!s->fptr)
+        return -1;
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, CAP_STREAM_MAGIC, 4);
+    h->version = CAP_STREAM_VERSION;
+    h->n = n;
+    h->seed = seed;
+    h->first_trial = first_trial;
+    h->trials = trials;
+    fwrite(h, sizeof(*h), 1, s->fptr);
+
+    for (i = 0; i < 2; i++) {
+        s->buf[i] = (uint8_t*) malloc(CAP_STREAM_BUF_SIZE);
+        s->buf_len[i] = 0;
+        s->buf_cap[i] = CAP_STREAM_BUF_SIZE;
+    }
+    s->active = 0;
+    s->flushing = s->closing = false;
+    s->offset = sizeof(*h);
+    s->index = NULL;
+    s->index_len = s->index_cap = 0;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    pthread_create(&s->thread, NULL, cap_stream_writer, s);
+    return 0;
+}
+
+// Adds the encoded cap sets of count consecutive trials starting at first_trial (safe to call from any thread)
+static void cap_stream_put(cap_stream* s, int first_trial, int count, const uint8_t* data, size_t len) {
+    pthread_mutex_lock(&s->lock);
+    while (s->buf_len[s->active] + len > s->buf_cap[s->active] && s->buf_len[s->active] > 0) {
+        if (s->flushing) {
+            pthread_cond_wait(&s->cond, &s->lock);
+        } else {
+            s->active = 1 - s->active;
+            s->flushing = true;
+            pthread_cond_broadcast(&s->cond);
+        }
+    }
+    if (len > s->buf_cap[s->active]) {
+        s->buf_cap[s->active] = len;
+        s->buf[s->active] = (uint8_t*) realloc(s->buf[s->active], len);
+    }
+    memcpy(s->buf[s->active] + s->buf_len[s->active], data, len);
+    s->buf_len[s->active] += len;
+
+    if (s->index_len == s->index_cap) {
+        s->index_cap = s->index_cap == 0 ? 256 : 2 * s->index_cap;
+        s->index = (cap_stream_chunk*) realloc(s->index, s->index_cap * sizeof(cap_stream_chunk));
+    }
+    s->index[s->index_len].first_trial = first_trial;
+    s->index[s->index_len].count = count;
+    s->index[s->index_len].offset = s->offset;
+    s->index_len++;
+    s->offset += len;
+    pthread_mutex_unlock(&s->lock);
+}
+
+static int cap_stream_compare_chunks(const void* a, const void* b) {
+    uint32_t x = ((const cap_stream_chunk*) a)->first_trial, y = ((const cap_stream_chunk*) b)->first_trial;
+
+    return (x > y) - (x < y);
+}
+
+// Writes out everything put so far along with the index, and closes the file (returns -1 on a write error).
+// trials is the number of trials actually run, which is less than given to cap_stream_open() if the run stopped early.
+static int cap_stream_close(cap_stream* s, int trials) {
+    static const uint8_t zeros[8];
+    cap_stream_footer f;
+    int res, pad;
+
+    pthread_mutex_lock(&s->lock);
+    s->closing = true;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+
+    fwrite(s->buf[s->active], 1, s->buf_len[s->active], s->fptr);
+    pad = -s->offset & 7;
+    fwrite(zeros, 1, pad, s->fptr);
+    s->offset += pad;
+    qsort(s->index, s->index_len, sizeof(cap_stream_chunk), cap_stream_compare_chunks);
+    fwrite(s->index, sizeof(cap_stream_chunk), s->index_len, s->fptr);
+    memset(&f, 0, sizeof(f));
+    f.index_offset = s->offset;
+    f.chunk_count = s->index_len;
+    memcpy(f.magic, CAP_STREAM_INDEX_MAGIC, 4);
+    fwrite(&f, sizeof(f), 1, s->fptr);
+    s->header.trials = trials;
+    fseek(s->fptr, 0, SEEK_SET);
+    fwrite(&s->header, sizeof(s->header), 1, s->fptr);
+    res = ferror(s->fptr) || fclose(s->fptr) != 0 ? -1 : 0;
+
+    free(s->buf[0]);
+    free(s->buf[1]);
+    free(s->index);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    return res;
+}
+
+static void cap_reader_close(cap_reader* r) {
+    munmap((void*) r->data, r->size);
+}
+
+// Maps a stream file written by cap_stream_close(), returning -1 if it cannot be read or is not complete
+static int cap_reader_open(cap_reader* r, const char* path) {
+    const cap_stream_footer* f;
+    struct stat st;
+    void* res;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) (sizeof(cap_stream_header) + sizeof(cap_stream_footer))
+        || st.st_size % 8 != 0) {
+        close(fd);
+        return -1;
+    }
+    res = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (res == MAP_FAILED)
+        return -1;
+
+    r->data = (const uint8_t*) res;
+    r->size = st.st_size;
+    r->header = (const cap_stream_header*) r->data;
+    f = (const cap_stream_footer*) (r->data + r->size - sizeof(cap_stream_footer));
+    if (memcmp(r->header->magic, CAP_STREAM_MAGIC, 4) != 0 || r->header->version != CAP_STREAM_VERSION
+        || memcmp(f->magic, CAP_STREAM_INDEX_MAGIC, 4) != 0 || f->index_offset % 8 != 0
+        || f->index_offset + f->chunk_count * sizeof(cap_stream_chunk) + sizeof(cap_stream_footer) != r->size) {
+        cap_reader_close(r);
+        return -1;
+    }
+    r->index = (const cap_stream_chunk*) (r->data + f->index_offset);
+    r->chunk_count = f->chunk_count;
+    return 0;
+}
+
+// Decodes the cap set of the given trial into out, returning its length, or -1 if the trial is not in the stream
+static int cap_reader_get(const cap_reader* r, int trial, int* out) {
+    const uint8_t* p;
+    int lo = 0, hi = r->chunk_count - 1, mid, i, len;
+
+    // Last chunk starting at or before the trial
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (r->index[mid].first_trial <= (uint32_t) trial)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    if (r->chunk_count == 0 || (uint32_t) trial < r->index[lo].first_trial
+        || (uint32_t) trial >= r->index[lo].first_trial + r->index[lo].count)
+        return -1;
+
+    p = r->data + r->index[lo].offset;
+    for (i = r->index[lo].first_trial; i < trial; i++)
+        p = cap_stream_decode(p, NULL, &len);
+    cap_stream_decode(p, out, &len);
+    return len;
+}
+
+#endif
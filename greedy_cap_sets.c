@@ -25,348 +25,1188 @@ Pseudo-code:
 initialize 3^n cards and shuffle their order
 G = (V, E) where every card corresponds to a node
 cap = empty set
+v = first node in the shuffled order
 while |V| != 0 do                               O(a_n)
-    v = node with the smallest in-degree        O(3^n)
     for each c in cap do                        O(a_n)
         delete node third(c, v)                 O(a_n)
+    delete node v                               O(a_n)
     for each node u do                          O(3^n)
         build edge (third(u, v) -> u)           O(1)
+        keep track of the node w with the smallest in-degree
     add v to cap                                O(1)
-    delete node v                               O(a_n)
+    v = w                                       O(1)
 
 Using adjacency lists and in-degree counters, the runtime is O(a_n^3).
+The adjacency lists live in a per-worker arena that is reset wholesale between trials:
+each node's list is a contiguous run of the arena that moves to a run twice as long when it fills up.
+Once the arena has grown to the largest trial seen so far, a trial makes no heap allocations.
+The edges do not have to be stored at all: the edges out of u are exactly (u -> third(c, u))
+for the cards c in the cap set, so they can be recomputed when u is eliminated instead.
+This counters-only engine (--engine counters) trades a few more third() calls for no edge memory,
+so the memory of a trial is O(3^n). The stored edges peak at over 100 * 3^n ints and stop fitting
+in cache around n=8, so by default the edges engine is used below n=8 and the counters engine from there.
+In small dimensions, the lanes engine (--engine lanes, see greedy_lanes.h) runs several trials in lock-step
+with SIMD instead, which is the default wherever it can run (n <= 7, where third() comes from the table).
+
+The in-degree of u only changes while u itself is visited by the edge-building pass,
+so the node with the smallest in-degree (ties broken by the shuffled order)
+is known as soon as the pass is over, without a separate scan over the graph.
+The alive nodes are kept in a dense array that the pass scans sequentially:
+a deleted node is swapped with the last one (its position is kept in a map), and every entry carries
+the node's position in the shuffled order to break ties with.
+
+Trials are independent, so they can be spread over several worker threads (--threads N).
+Each worker owns its own graph workspace and results, which are merged once all trials are done.
+Every trial draws from its own random stream, derived from the seed and the trial's index (see rng.h),
+so a run gives the same cap sets for a given seed no matter how many threads it uses.
+Any single trial can be regenerated from the seed and its index (--replay k), so instead of storing caps,
+a run only logs the indices of trials with rare sizes (--log FILE): the first few trials of every size
+in trial order, which covers every size that occurs fewer times than that. Each worker logs the first few
+of every size it sees beyond those already in the results it continues from, which include the first few
+overall, and the log is cut back to them before it is written, so it does not depend on the threads.
+Sizes are tallied in a dense histogram indexed by size, so recording a trial is O(1), and the mean, variance,
+skewness and percentiles are computed from the histogram with exact integer sums, so that they do not depend
+on how the trials were split between threads, shards or resumes. Line counts keep running moments instead
+(see moments.h).
+Every cap set can also be streamed to a compact binary file (--caps FILE, see cap_stream.h)
+by a background thread, and printed back from it (--read-caps FILE).
+A campaign can also be split over independent processes (--shard k/K runs the k-th of K equal ranges
+of trial indices, counting from 0). Each shard writes its results to data/n<n>_t<trials>.part<k>_of_<K>
+instead of the histogram, and --merge combines the parts into the results of a single run.
+Long runs can save their results every few seconds (--checkpoint SECS, to data/n<n>_t<trials>.ckpt,
+in the same format as the parts of a sharded run), and --resume continues from the last checkpoint:
+trials run in rounds that end at a common trial index, so a checkpoint only needs the results so far
+and the index to continue from.
+Rounds also let a run stop early once its estimates are precise enough: with --mean-ci W, it stops
+at the end of the first round where the 95% confidence interval of the mean size is narrower than W,
+and with --prob-ci W, where that of the probability of the target size (--target-size, a_n by default) is.
+-t is then the most trials to run. The rounds of such a run grow with the number of trials so far,
+so where it stops only depends on the seed.
+--lines also counts the lines in the complement of every cap set, with the Fourier transform
+over Z_3^n (see line_count.h) so that it stays cheap next to the trial itself.
+
+The dimension is chosen at runtime (-n), but the greedy algorithm itself lives in greedy_kernel.h,
+which is compiled once per supported dimension so that its loops are specialized for it.
+
+Compile with: gcc -O3 -pthread greedy_cap_sets.c -o greedy_cap_sets -lm
+Usage: greedy_cap_sets [-n dimension] [-t trials] [--seed S] [--threads N] [--no-table] [--no-simd]
+                       [--log FILE] [--log-per-size K] [--replay k] [--caps FILE] [--read-caps FILE] [--lines]
+                       [--engine edges|counters|lanes] [--shard k/K] [--checkpoint SECS] [--resume]
+                       [--mean-ci W] [--prob-ci W] [--target-size K]
+       greedy_cap_sets --merge FILE...
+
+For n <= 7, third() is looked up in a table that is generated once into tables/ (see third_table.h).
+The edge-building pass computes its thirds in batches with AVX2 when the CPU supports it (see third_batch.h).
 */
 
 #include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+#include "bitset.h"
+#include "cap_stream.h"
+#include "greedy_lanes.h"
+#include "line_count.h"
+#include "moments.h"
+#include "packed_card.h"
+#include "rng.h"
+#include "third_batch.h"
+#include "third_table.h"
 
-// Powers of 3: 3, 9, 27, 81, 243, 729, 2187, 6561, 19683
-#define n 4  // Number of attributes/dimensions
-#define tn 81  // 3^n
+#define min_n 2  // Smallest and largest dimensions with a specialized kernel
+#define max_n 12
 
-#define trials 10000
+#define trial_chunk 64  // Trials claimed by a worker at a time
+#define min_edge_cap 4  // Initial length of an adjacency list in the arena
 
-#define map_size 256
+#define engine_edges 0
+#define engine_counters 1
+#define engine_lanes 2
 
-// Element of Z_3^n
-typedef char card[n];
+// Dimensions that use the lanes and counters engines by default
+#define lanes_max_n 7
+#define counters_min_n 8
 
-// Linked list node
-typedef struct list_node_struct {
-    int data;
-    struct list_node_struct* next;
-} list_node;
+// Largest dimension that looks third() up in the table
+// (the n=8 table is 86 MB, so it misses cache and the packed arithmetic is faster)
+#define table_max_n 7
 
-// Double linked list node
-typedef struct dbl_list_node_struct {
-    int data;
-    struct dbl_list_node_struct* next;
-    struct dbl_list_node_struct* prev;
-} dbl_list_node;
+// Trial whose cap set had a rare size
+typedef struct log_entry_struct {
+    int trial, size;
+} log_entry;
 
-// Graph node that stores a card, an adjacency list, its in-degree, and if it has been eliminated
-typedef struct graph_node_struct {
-    card c;
-    int in_deg;
-    bool is_elim;
-    list_node* neighbors;
-} graph_node;
+// Histogram and moments of cap set sizes along with the smallest and largest cap sets found
+// and the log of trials with rare sizes
+typedef struct results_struct {
+    int* hist;  // hist[k] = number of cap sets of size k, for k <= 3^n
+    long count;  // Number of cap sets
+    moments lines;  // Lines in the complements of the cap sets, if they are counted
+    int* max_cap_set, max_cap_set_len, max_trial;
+    int* min_cap_set, min_cap_set_len, min_trial;
+    log_entry* log;
+    int log_len, log_cap;
+} results;
+
+// Everything a worker thread needs to run trials on its own
+// The graph is stored as one array per field, indexed by card, so that each pass only touches the fields it needs
+typedef struct workspace_struct {
+    int* in_deg;
+    int* edges, * edge_len, * edge_cap;  // Adjacency list of each card (at an offset into the arena)
+    int* ord;
+    int* alive, alive_len;  // Cards not yet eliminated, in no particular order
+    int* alive_rank;  // alive_rank[k] = position of alive[k] in the shuffled order
+    int* alive_pos;  // alive_pos[c] = position of card c in alive, if it is alive
+    uint64_t* alive_bits;  // The same cards as a bitset
+    int* thirds;  // thirds[k] = third(best_index, alive[k]) during the edge-building pass
+    int* cap_set, cap_set_len;
+    int* arena, arena_len, arena_cap;
+    rng rng;
+    int id;
+    results res;
+    uint8_t* out;  // Encoded cap sets of the current chunk of trials, if they are streamed
+    int out_len, out_cap;
+    uint64_t* bits;  // Scratch space for counting lines
+    uint64_t* fourier;
+    lanes lane_state;  // Lanes engine state and the cap sets of the current chunk of trials
+    int* chunk_caps, * chunk_lens;
+} workspace;
 
-int setter[3][3] = {{0, 2, 1}, {2, 1, 0}, {1, 0, 2}};
 int known_max[7] = {1, 2, 4, 9, 20, 45, 112};
 int max_4_cap[20] = {0, 2, 6, 8, 13, 19, 21, 23, 25, 31, 49, 55, 57, 59, 61, 67, 72, 74, 78, 80};
 
-graph_node nodes[tn];
-dbl_list_node graph_list[tn], * graph_head;
-int ord[tn];
+int n = 4;  // Number of attributes/dimensions
+int tn;  // 3^n
+int trials = 10000;
+int trial_begin, trial_end;  // Range of trials run by this process
+int round_end;  // Trials are claimed up to round_end (see run_trials())
+char checkpoint_fname[100];
+int checkpoint_secs = 0;  // Target time between checkpoints, 0 for none
+double mean_ci = 0, prob_ci = 0;  // Widths of the confidence intervals to stop at, 0 for none
+int target_size = -1;
+bool stopped_early = false;
+int shard = 0, num_shards = 1;
+uint64_t seed;
+char* log_fname = NULL;
+int log_per_size = 10;  // Trials of each size logged
+const int* log_base_hist;  // Histogram of the trials done before this process started (read-only while workers run)
+char* caps_fname = NULL;
+cap_stream caps;
+bool count_complement_lines = false;
 
-int cap_set[tn], cap_set_len;
+// Packed card vectors (also narrowed to 32 bits) and the third-point table (NULL if unused),
+// shared and read-only once init() has run
+packed_card* codes;
+uint32_t* codes32;
+const uint16_t* third_tab;
+bool use_table = true, use_simd = true;
+int engine = -1;  // engine_edges, engine_counters or engine_lanes, -1 to choose by dimension
+char* engine_names[3] = {"edges", "counters", "lanes"};
 
-int data_keys[map_size], data_vals[map_size];
-int max_cap_set[tn], max_cap_set_len;
-int min_cap_set[tn], min_cap_set_len;
+int num_threads = 1;
+atomic_int next_trial, trials_done;
 
-int data_get_index(int k) {
+// Initializes card vectors
+void init() {
     int i;
 
-    // Linear probing
-    for (i = k % map_size; data_keys[i] != 0 && data_keys[i] != k; i = (i+1) % map_size) {
-        if (i == (k - 1) % map_size) {
-            printf("Map overflow!\n");
-            return -1;
-        }
+    for (tn = 1, i = 0; i < n; i++)
+        tn *= 3;
+
+    packed_init();
+    codes = (packed_card*) malloc(tn * sizeof(packed_card));
+    codes32 = (uint32_t*) malloc(tn * sizeof(uint32_t));
+    for (i = 0; i < tn; i++) {
+        codes[i] = packed_from_index(i);
+        codes32[i] = packed_narrow(codes[i]);
     }
-    if (data_keys[i] == 0)
-        data_keys[i] = k;
-    return i;
+
+    third_tab = use_table && n <= table_max_n ? third_table_open(n) : NULL;
+}
+
+void init_results(results* r) {
+    r->hist = (int*) calloc(tn + 1, sizeof(int));
+    r->count = 0;
+    moments_init(&r->lines);
+    r->max_cap_set = (int*) malloc(tn * sizeof(int));
+    r->min_cap_set = (int*) malloc(tn * sizeof(int));
+    r->max_cap_set_len = 0;
+    r->min_cap_set_len = INT_MAX;
+    r->max_trial = r->min_trial = INT_MAX;
+    r->log = NULL;
+    r->log_len = r->log_cap = 0;
+}
+
+void free_results(results* r) {
+    free(r->hist);
+    free(r->max_cap_set);
+    free(r->min_cap_set);
+    free(r->log);
+}
+
+void add_log_entry(results* r, int trial, int size) {
+    if (r->log_len == r->log_cap) {
+        r->log_cap = r->log_cap == 0 ? 64 : 2 * r->log_cap;
+        r->log = (log_entry*) realloc(r->log, r->log_cap * sizeof(log_entry));
+    }
+    r->log[r->log_len].trial = trial;
+    r->log[r->log_len].size = size;
+    r->log_len++;
 }
 
-// Get data value corresponding to k (defaults to 0)
-int data_get(int k) {
-    return data_vals[data_get_index(k)];
+// Initializes a worker's workspace
+void init_workspace(workspace* ws, int id) {
+    ws->id = id;
+    ws->in_deg = (int*) malloc(tn * sizeof(int));
+    if (engine == engine_edges) {
+        ws->edges = (int*) malloc(tn * sizeof(int));
+        ws->edge_len = (int*) malloc(tn * sizeof(int));
+        ws->edge_cap = (int*) malloc(tn * sizeof(int));
+    } else {
+        ws->edges = ws->edge_len = ws->edge_cap = NULL;
+    }
+    ws->ord = (int*) malloc(tn * sizeof(int));
+    ws->alive = (int*) malloc(tn * sizeof(int));
+    ws->alive_rank = (int*) malloc(tn * sizeof(int));
+    ws->alive_pos = (int*) malloc(tn * sizeof(int));
+    ws->alive_bits = bitset_alloc(tn);
+    ws->thirds = (int*) malloc(tn * sizeof(int));
+    ws->cap_set = (int*) malloc(tn * sizeof(int));
+
+    // The arena is only allocated by the edges engine, once it stores edges
+    ws->arena = NULL;
+    ws->arena_cap = 0;
+
+    // Grown as cap sets are encoded (bounding it by 3^n cards would take 170 MB per worker at n=12)
+    ws->out = NULL;
+    ws->out_len = ws->out_cap = 0;
+    ws->bits = bitset_alloc(tn);
+    ws->fourier = (uint64_t*) malloc(2 * tn * sizeof(uint64_t));
+    if (engine == engine_lanes) {
+        lanes_init(&ws->lane_state, tn, third_tab);
+        ws->chunk_caps = (int*) malloc(trial_chunk * tn * sizeof(int));
+        ws->chunk_lens = (int*) malloc(trial_chunk * sizeof(int));
+    }
+    init_results(&ws->res);
 }
 
-// Set data value associated with k to v (k cannot be 0)
-void data_set(int k, int v) {
-    data_vals[data_get_index(k)] = v;
+void free_workspace(workspace* ws) {
+    free(ws->in_deg);
+    free(ws->edges);
+    free(ws->edge_len);
+    free(ws->edge_cap);
+    free(ws->ord);
+    free(ws->alive);
+    free(ws->alive_rank);
+    free(ws->alive_pos);
+    free(ws->alive_bits);
+    free(ws->thirds);
+    free(ws->cap_set);
+    free(ws->arena);
+    free(ws->out);
+    free(ws->bits);
+    free(ws->fourier);
+    if (engine == engine_lanes) {
+        lanes_free(&ws->lane_state);
+        free(ws->chunk_caps);
+        free(ws->chunk_lens);
+    }
+    free_results(&ws->res);
 }
 
-// Returns the decimal value of a card interpreted in base-3
-int card_index(card c) {
-    int res = c[n-1], i;
-    
-    for (i = n-2; i >= 0; i--)
-        res = 3 * res + c[i];
+// Bump-allocates l ints from the arena and returns their offset
+// (the arena only ever grows, so it stops reallocating once it fits the largest trial)
+int arena_alloc(workspace* ws, int l) {
+    int res = ws->arena_len;
+
+    ws->arena_len += l;
+    if (ws->arena_len > ws->arena_cap) {
+        if (ws->arena_cap == 0)
+            ws->arena_cap = 8 * tn;
+        while (ws->arena_len > ws->arena_cap)
+            ws->arena_cap *= 2;
+        ws->arena = (int*) realloc(ws->arena, ws->arena_cap * sizeof(int));
+    }
     return res;
 }
 
-// Returns the index of the card that forms a set with i1 and i2
-int third(int i1, int i2) {
-    int i;
-    card third_card;
+// Builds an edge between from and to
+static inline void add_neighbor(workspace* ws, int from, int to) {
+    int edges;
+
+    // Move a full adjacency list to a run twice as long
+    if (ws->edge_len[from] == ws->edge_cap[from]) {
+        ws->edge_cap[from] = ws->edge_cap[from] == 0 ? min_edge_cap : 2 * ws->edge_cap[from];
+        edges = arena_alloc(ws, ws->edge_cap[from]);
+        memcpy(ws->arena + edges, ws->arena + ws->edges[from], ws->edge_len[from] * sizeof(int));
+        ws->edges[from] = edges;
+    }
 
-    for (i = 0; i < n; i++)
-        third_card[i] = setter[nodes[i1].c[i]][nodes[i2].c[i]];
-    return card_index(third_card);
+    ws->arena[ws->edges[from] + ws->edge_len[from]++] = to;
+    ws->in_deg[to]++;
 }
 
-// Fisher-Yates shuffle
-void shuffle(int* a, int l) {
-    int i, j, t;
+// Specialized kernels, complete_cap_set_<engine>_<n>() for every engine and supported n
+#define n 2
+#define tn 9
+#include "greedy_kernel.h"
+#undef n
+#undef tn
+#define n 3
+#define tn 27
+#include "greedy_kernel.h"
+#undef n
+#undef tn
+#define n 4
+#define tn 81
+#include "greedy_kernel.h"
+#undef n
+#undef tn
+#define n 5
+#define tn 243
+#include "greedy_kernel.h"
+#undef n
+#undef tn
+#define n 6
+#define tn 729
+#include "greedy_kernel.h"
+#undef n
+#undef tn
+#define n 7
+#define tn 2187
+#include "greedy_kernel.h"
+#undef n
+#undef tn
+#define n 8
+#define tn 6561
+#include "greedy_kernel.h"
+#undef n
+#undef tn
+#define n 9
+#define tn 19683
+#include "greedy_kernel.h"
+#undef n
+#undef tn
+#define n 10
+#define tn 59049
+#include "greedy_kernel.h"
+#undef n
+#undef tn
+#define n 11
+#define tn 177147
+#include "greedy_kernel.h"
+#undef n
+#undef tn
+#define n 12
+#define tn 531441
+#include "greedy_kernel.h"
+#undef n
+#undef tn
 
-    for (i = l-1; i > 0; i--) {
-        j = rand() % (i+1);
-        t = a[j];
-        a[j] = a[i];
-        a[i] = t;
+void (*kernels[2][max_n+1])(workspace*) = {
+    {
+        NULL, NULL, complete_cap_set_edges_2, complete_cap_set_edges_3, complete_cap_set_edges_4,
+        complete_cap_set_edges_5, complete_cap_set_edges_6, complete_cap_set_edges_7, complete_cap_set_edges_8,
+        complete_cap_set_edges_9, complete_cap_set_edges_10, complete_cap_set_edges_11, complete_cap_set_edges_12
+    }, {
+        NULL, NULL, complete_cap_set_counters_2, complete_cap_set_counters_3, complete_cap_set_counters_4,
+        complete_cap_set_counters_5, complete_cap_set_counters_6, complete_cap_set_counters_7,
+        complete_cap_set_counters_8, complete_cap_set_counters_9, complete_cap_set_counters_10,
+        complete_cap_set_counters_11, complete_cap_set_counters_12
     }
+};
+
+void (*complete_cap_set)(workspace*);
+
+// Returns the index of the card that forms a set with i1 and i2
+int third(int i1, int i2) {
+    if (third_tab)
+        return third_tab[i1*tn + i2];
+    return packed_index(packed_third(codes[i1], codes[i2]), n);
 }
 
-// Initializes card vectors
-void init() {
-    int i = 0, j;
-    int count[n] = {0};
-    bool done = false;
-
-    srand(time(NULL));
-
-    while (!done) {
-        for (j = 0; j < n; j++)
-            nodes[i].c[j] = count[j];
-        graph_list[i].data = i;
-        ord[i] = i;
-        i++;
-        
-        j = 0;
-        count[j]++;
-        while (count[j] == 3) {
-            count[j] = 0;
-            j++;
-            if (j >= n) {
-                done = true;
-                break;
+// Counts the lines in a set of cards, checking every pair when the set is small
+// and using the Fourier transform (see line_count.h) when that is cheaper
+long long count_lines(workspace* ws, int* cards, int l) {
+    int i, j, c;
+    long long res = 0;
+
+    for (i = 0; i < l; i++)
+        bitset_set(ws->bits, cards[i]);
+
+    if ((long long) l * l < 2LL * n * tn) {
+        // Count each line once, from its two smallest cards
+        for (i = 0; i < l; i++) {
+            for (j = i+1; j < l; j++) {
+                c = third(cards[i], cards[j]);
+                if (c > cards[i] && c > cards[j] && bitset_test(ws->bits, c))
+                    res++;
             }
-            count[j]++;
         }
+    } else {
+        res = line_count_fourier(ws->bits, tn, ws->fourier);
     }
+
+    bitset_clear(ws->bits, tn);
+    return res;
 }
 
-// Resets graph
-void reinit() {
-    int i;
+// Counts the lines in the complement of a set of cards
+// (uses ws->thirds for the complement, so it must not be called during a trial)
+long long count_lines_complement(workspace* ws, int* cards, int l) {
+    int i, len;
 
-    shuffle(ord, tn);
-    graph_head = graph_list + ord[0];
-    cap_set_len = 0;
-    
-    for (i = 0; i < tn; i++) {
-        nodes[i].is_elim = false;
-        nodes[i].in_deg = 0;
-        nodes[i].neighbors = NULL;
+    bitset_fill(ws->bits, tn);
+    for (i = 0; i < l; i++)
+        bitset_reset(ws->bits, cards[i]);
+    len = bitset_to_array(ws->bits, tn, ws->thirds);
+    bitset_clear(ws->bits, tn);
+    return count_lines(ws, ws->thirds, len);
+}
 
-        graph_list[ord[i]].prev = i == 0 ? NULL : graph_list + (ord[i-1]);
-        graph_list[ord[i]].next = i == tn-1 ? NULL : graph_list + (ord[i+1]);
+void print_cap_set(int* cs, int csl) {
+    int i, j;
+
+    for (i = 0; i < csl; i++) {
+        printf("(");
+        for (j = 0; j < n; j++) {
+            printf(j == n-1 ? "%d" : "%d, " , packed_digit(codes[cs[i]], j));
+        }
+        printf(i == csl - 1 ? ") " : "), ");
     }
+    printf("[Length %d]\n", csl);
 }
 
-// Eliminates a node and updates the in-degrees of its neighbors
-void elim(int i) {
-    list_node* curr = nodes[i].neighbors, * prev;
-    
-    nodes[i].is_elim = true;
-    while (curr) {
-        nodes[curr->data].in_deg--;
-        prev = curr;
-        curr = curr->next;
-        free(prev);
+// Keeps the cap set found in the given trial as the largest/smallest of r if it beats the current one
+// (ties go to the earliest trial, so the results do not depend on which worker ran which trial)
+void keep_max(results* r, int* cs, int len, int trial) {
+    if (len > r->max_cap_set_len || (len == r->max_cap_set_len && trial < r->max_trial)) {
+        memcpy(r->max_cap_set, cs, len * sizeof(int));
+        r->max_cap_set_len = len;
+        r->max_trial = trial;
     }
+}
 
-    if (graph_list[i].prev)
-        graph_list[i].prev->next = graph_list[i].next;
-    else
-        graph_head = graph_list[i].next;
-    if (graph_list[i].next)
-        graph_list[i].next->prev = graph_list[i].prev;
+void keep_min(results* r, int* cs, int len, int trial) {
+    if (len < r->min_cap_set_len || (len == r->min_cap_set_len && trial < r->min_trial)) {
+        memcpy(r->min_cap_set, cs, len * sizeof(int));
+        r->min_cap_set_len = len;
+        r->min_trial = trial;
+    }
 }
 
-// Builds an edge between from and to
-void add_neighbor(graph_node* from, int to_index) {
-    list_node* to = (list_node*) malloc(sizeof(list_node));
-
-    to->data = to_index;
-    to->next = from->neighbors;
-    from->neighbors = to;
-    nodes[to_index].in_deg++;
-}
-
-void complete_cap_set() {
-    int i, o, best_count, best_index, to_elim, left = tn;
-    dbl_list_node* curr;
-
-    reinit();
-    while (left > 0) {
-        // Find card that eliminates the fewest new cards
-        best_count = INT_MAX;
-        best_index = -1;
-        for (curr = graph_head; curr; curr = curr->next) {
-            o = curr->data;
-            if (nodes[o].in_deg < best_count) {
-                best_count = nodes[o].in_deg;
-                best_index = o;
+// Adds the current cap set of a workspace, found in the given trial, to its results
+void record_cap_set(workspace* ws, int trial) {
+    results* r = &ws->res;
+    int len = ws->cap_set_len;
+
+    if (log_fname && log_base_hist[len] + r->hist[len] < log_per_size)
+        add_log_entry(r, trial, len);
+    r->hist[len]++;
+    r->count++;
+    if (count_complement_lines)
+        moments_add(&r->lines, count_lines_complement(ws, ws->cap_set, len));
+    keep_max(r, ws->cap_set, len, trial);
+    keep_min(r, ws->cap_set, len, trial);
+}
+
+// Adds the results of src into dst
+void merge_results(results* dst, results* src) {
+    int i;
+
+    for (i = 0; i <= tn; i++)
+        dst->hist[i] += src->hist[i];
+    dst->count += src->count;
+    moments_merge(&dst->lines, &src->lines);
+    for (i = 0; i < src->log_len; i++)
+        add_log_entry(dst, src->log[i].trial, src->log[i].size);
+    keep_max(dst, src->max_cap_set, src->max_cap_set_len, src->max_trial);
+    if (src->min_trial != INT_MAX)
+        keep_min(dst, src->min_cap_set, src->min_cap_set_len, src->min_trial);
+}
+
+int compare_ints(const void* a, const void* b) {
+    return *(int*) a - *(int*) b;
+}
+
+// Worker thread: claims chunks of trials until none are left
+void* run_worker(void* arg) {
+    workspace* ws = (workspace*) arg;
+    int i, start, end, done, next = 0, count = trial_end - trial_begin, inc = count < 100 ? 1 : count / 100;
+
+    while ((start = atomic_fetch_add(&next_trial, trial_chunk)) < round_end) {
+        end = start + trial_chunk < round_end ? start + trial_chunk : round_end;
+        if (engine == engine_lanes)
+            lanes_run(&ws->lane_state, seed, start, end, ws->chunk_caps, ws->chunk_lens);
+        for (i = start; i < end; i++) {
+            if (engine == engine_lanes) {
+                ws->cap_set_len = ws->chunk_lens[i - start];
+                memcpy(ws->cap_set, ws->chunk_caps + (i - start) * tn, ws->cap_set_len * sizeof(int));
+            } else {
+                rng_seed(&ws->rng, seed, i);
+                complete_cap_set(ws);
             }
-        }
+            record_cap_set(ws, i);
+            if (caps_fname) {
+                // The cap set has been recorded, so it can be sorted in place for encoding
+                qsort(ws->cap_set, ws->cap_set_len, sizeof(int), compare_ints);
+                if (ws->out_len + CAP_STREAM_MAX_BYTES(ws->cap_set_len) > ws->out_cap) {
+                    ws->out_cap = 2 * (ws->out_len + CAP_STREAM_MAX_BYTES(ws->cap_set_len));
+                    ws->out = (uint8_t*) realloc(ws->out, ws->out_cap);
+                }
+                ws->out_len += cap_stream_encode(ws->out + ws->out_len, ws->cap_set, ws->cap_set_len);
+            }
+            done = atomic_fetch_add(&trials_done, 1) + 1;
 
-        // Eliminate cards that form a line with the card at best_index
-        // and some other card in the cap set so far
-        elim(best_index);
-        left--;
-        for (i = 0; i < cap_set_len; i++) {
-            to_elim = third(best_index, cap_set[i]);
-            if (!nodes[to_elim].is_elim) {
-                elim(to_elim);
-                left--;
+            // Only the first worker reports progress
+            if (ws->id == 0 && done >= next) {
+                printf("\r%d%% complete", (int) (100LL * done / count));
+                fflush(stdout);
+                next = done + inc;
             }
         }
-
-        // Update eliminators/adjacency
-        for (curr = graph_head; curr; curr = curr->next) {
-            to_elim = third(best_index, curr->data);
-            if (!nodes[to_elim].is_elim)
-                add_neighbor(nodes + to_elim, curr->data);
+        if (caps_fname) {
+            cap_stream_put(&caps, start, end - start, ws->out, ws->out_len);
+            ws->out_len = 0;
         }
+    }
+    return NULL;
+}
+
+// Returns the smallest size k such that at least a fraction p of the cap sets have size <= k
+int size_percentile(results* r, double p) {
+    long count = 0;
+    int k;
 
-        cap_set[cap_set_len] = best_index;
-        cap_set_len++;
+    for (k = 0; k < tn; k++) {
+        count += r->hist[k];
+        if (count >= p * r->count)
+            break;
     }
+    return k;
 }
 
-// TODO: Implement optimal pair-checking algorithm
-// Assumes cards are sorted in increasing order
-int count_lines(int* cards, int l) {
-    int i, j, k, third_index, res = 0;
+// Sets m to the moments of the sizes, from the histogram
+// (the sums of the deviations from the median are exact integers, so m only depends on the histogram)
+void size_moments(results* r, moments* m) {
+    __int128 d, d1 = 0, d2 = 0, d3 = 0;
+    long double count = r->count;
+    int k, c;
 
-    for (i = 0; i < l-2; i++) {
-        for (j = i+1; j < l-1; j++) {
-            third_index = third(cards[i], cards[j]);
-            for (k = j+1; k < l; k++) {
-                if (cards[k] == third_index) {
-                    res++;
-                    break;
-                } else if (cards[k] > third_index) {
-                    break;
-                }
-            }
-        }
+    moments_init(m);
+    if (r->count == 0)
+        return;
+    c = size_percentile(r, 0.5);
+    for (k = 0; k <= tn; k++) {
+        d = k - c;
+        d1 += d * r->hist[k];
+        d2 += d * d * r->hist[k];
+        d3 += d * d * d * r->hist[k];
     }
-    return res;
+    m->count = r->count;
+    m->mean = c + d1 / count;
+
+    // Sums of squared and cubed deviations from the mean (the numerator of m2 is exact)
+    m->m2 = (r->count * d2 - d1 * d1) / count;
+    m->m3 = d3 - 3 * (long double) d1 * d2 / count + 2 * (long double) d1 * d1 * d1 / (count * count);
 }
 
-int count_lines_complement(int* cards, int l) {
-    int i, j = 0, comp[tn];
+// Regenerates and prints the cap set of a single trial
+void replay_trial(int trial) {
+    workspace ws;
 
-    for (i = 0; i < tn; i++) {
-        if (j >= l || cards[j] != i)
-            comp[i-j] = i;
+    init_workspace(&ws, 0);
+    rng_seed(&ws.rng, seed, trial);
+    complete_cap_set(&ws);
+    printf("Trial %d: ", trial);
+    print_cap_set(ws.cap_set, ws.cap_set_len);
+    free_workspace(&ws);
+}
+
+int compare_log_entries(const void* a, const void* b) {
+    return ((log_entry*) a)->trial - ((log_entry*) b)->trial;
+}
+
+// Sorts the log by trial and keeps only the first log_per_size trials of each size
+// (workers log the first ones they see, so the log of merged results can have more)
+void trim_log(results* r) {
+    int i, len = 0, * count;
+
+    // Without --log nothing is logged and log is NULL, which qsort() must not be given
+    if (r->log_len == 0)
+        return;
+
+    count = (int*) calloc(tn + 1, sizeof(int));
+    qsort(r->log, r->log_len, sizeof(log_entry), compare_log_entries);
+    for (i = 0; i < r->log_len; i++) {
+        if (count[r->log[i].size]++ < log_per_size)
+            r->log[len++] = r->log[i];
+    }
+    r->log_len = len;
+    free(count);
+}
+
+// Writes the trials of rare sizes in order, with what is needed to replay them
+void write_log(results* r) {
+    int i;
+    FILE* fptr = fopen(log_fname, "w");
+
+    if (!fptr) {
+        printf("Could not write %s\n", log_fname);
+        return;
+    }
+    trim_log(r);
+    fprintf(fptr, "# n=%d seed=%llu trials=%d\n", n, (unsigned long long) seed, trials);
+    fprintf(fptr, "# trial size\n");
+    for (i = 0; i < r->log_len; i++)
+        fprintf(fptr, "%d %d\n", r->log[i].trial, r->log[i].size);
+    fclose(fptr);
+}
+
+// Prints every cap set of a stream file in trial order
+int read_caps(char* fname) {
+    cap_reader r;
+    int i, len, * cs;
+
+    if (cap_reader_open(&r, fname) != 0) {
+        printf("Could not read %s\n", fname);
+        return 1;
+    }
+    n = r.header->n;
+    if (n < min_n || n > max_n) {
+        cap_reader_close(&r);
+        return 1;
+    }
+    init();
+    cs = (int*) malloc(tn * sizeof(int));
+    printf("n=%d seed=%llu trials %u-%u\n", n, (unsigned long long) r.header->seed,
+        r.header->first_trial, r.header->first_trial + r.header->trials - 1);
+    for (i = r.header->first_trial; i < (int) (r.header->first_trial + r.header->trials); i++) {
+        len = cap_reader_get(&r, i, cs);
+        if (len < 0)
+            continue;
+        printf("Trial %d: ", i);
+        print_cap_set(cs, len);
+    }
+    free(cs);
+    cap_reader_close(&r);
+    return 0;
+}
+
+void print_results(results* r) {
+    int i;
+    double percentiles[7] = {0.01, 0.05, 0.25, 0.5, 0.75, 0.95, 0.99};
+    moments sizes;
+
+    printf("Smallest cap set found: %d (trial %d)\n", r->min_cap_set_len, r->min_trial);
+    printf("Largest cap set found: %d (trial %d)\n", r->max_cap_set_len, r->max_trial);
+
+    if (n < 7) {
+        printf("Number of maximum cap sets: %d (probability %.5f)\n",
+            r->hist[known_max[n]], (float) r->hist[known_max[n]] / r->count);
+    }
+    size_moments(r, &sizes);
+    printf("Average cap set size: %.5f\n", sizes.mean);
+    printf("Standard deviation: %.5f, skewness: %.5f\n", sqrt(moments_variance(&sizes)), moments_skewness(&sizes));
+    printf("Percentiles:");
+    for (i = 0; i < 7; i++)
+        printf(" %g%%: %d", 100 * percentiles[i], size_percentile(r, percentiles[i]));
+    printf("\n");
+    if (r->lines.count > 0) {
+        printf("Average number of lines in the complement: %.3f (standard deviation %.3f)\n",
+            r->lines.mean, sqrt(moments_variance(&r->lines)));
+    }
+}
+
+// Writes the histogram to data/n<n>_t<trials>.txt
+void write_histogram(results* r) {
+    int i;
+    char fname[100];
+    FILE* fptr;
+
+    snprintf(fname, 100, "data/n%d_t%d.txt", n, trials);
+    fptr = fopen(fname, "w");
+    if (!fptr) {
+        printf("Could not write %s\n", fname);
+        return;
+    }
+    for (i = 0; i <= tn; i++)
+        if (r->hist[i] != 0)
+            fprintf(fptr, "%d: %d\n", i, r->hist[i]);
+    fclose(fptr);
+}
+
+void write_moments(FILE* fptr, char* name, moments* m) {
+    // Hexadecimal floats, so that the moments are read back exactly
+    fprintf(fptr, "%s %ld %a %a %a\n", name, m->count, m->mean, m->m2, m->m3);
+}
+
+void write_cap(FILE* fptr, char* name, int trial, int* cs, int len) {
+    int i;
+
+    fprintf(fptr, "%s %d %d", name, trial, len);
+    for (i = 0; i < len; i++)
+        fprintf(fptr, " %d", cs[i]);
+    fprintf(fptr, "\n");
+}
+
+// Writes the results of trials [trial_begin, end), along with everything needed to merge or resume them, to fname
+// (under a temporary name first, so that fname always holds a complete file)
+void write_partial(results* r, char* fname, int end) {
+    int i;
+    char tmp_fname[300];
+    FILE* fptr;
+
+    snprintf(tmp_fname, sizeof(tmp_fname), "%s.tmp", fname);
+    fptr = fopen(tmp_fname, "w");
+    if (!fptr) {
+        printf("Could not write %s\n", fname);
+        return;
+    }
+    trim_log(r);
+    fprintf(fptr, "greedy_cap_sets partial results\n");
+    fprintf(fptr, "n %d\nseed %llu\ntrials %d\nrange %d %d\n", n, (unsigned long long) seed, trials,
+        trial_begin, end);
+    write_moments(fptr, "lines", &r->lines);
+    write_cap(fptr, "max", r->max_trial, r->max_cap_set, r->max_cap_set_len);
+    write_cap(fptr, "min", r->min_trial, r->min_cap_set, r->min_cap_set_len);
+    for (i = 0; i <= tn; i++)
+        if (r->hist[i] != 0)
+            fprintf(fptr, "hist %d %d\n", i, r->hist[i]);
+    for (i = 0; i < r->log_len; i++)
+        fprintf(fptr, "log %d %d\n", r->log[i].trial, r->log[i].size);
+
+    if (fflush(fptr) != 0 || fsync(fileno(fptr)) != 0 || fclose(fptr) != 0 || rename(tmp_fname, fname) != 0)
+        printf("Could not write %s\n", fname);
+}
+
+// Reads the header of a partial results file, returning -1 if it is not one
+int read_partial_header(FILE* fptr, int* pn, uint64_t* pseed, int* ptrials, int* begin, int* end) {
+    unsigned long long s;
+
+    if (fscanf(fptr, "greedy_cap_sets partial results n %d seed %llu trials %d range %d %d",
+        pn, &s, ptrials, begin, end) != 5)
+        return -1;
+    *pseed = s;
+    return 0;
+}
+
+int read_moments(FILE* fptr, char* name, moments* m) {
+    char key[16];
+
+    if (fscanf(fptr, "%15s %ld %la %la %la", key, &m->count, &m->mean, &m->m2, &m->m3) != 5
+        || strcmp(key, name) != 0)
+        return -1;
+    return 0;
+}
+
+int read_cap(FILE* fptr, char* name, int* trial, int* cs, int* len) {
+    char key[16];
+    int i;
+
+    if (fscanf(fptr, "%15s %d %d", key, trial, len) != 3 || strcmp(key, name) != 0 || *len < 0 || *len > tn)
+        return -1;
+    for (i = 0; i < *len; i++)
+        if (fscanf(fptr, "%d", cs + i) != 1)
+            return -1;
+    return 0;
+}
+
+// Reads the rest of a partial results file into r (initialized for the same n)
+int read_partial(FILE* fptr, results* r) {
+    char key[16];
+    int k, v;
+
+    if (read_moments(fptr, "lines", &r->lines) != 0
+        || read_cap(fptr, "max", &r->max_trial, r->max_cap_set, &r->max_cap_set_len) != 0
+        || read_cap(fptr, "min", &r->min_trial, r->min_cap_set, &r->min_cap_set_len) != 0)
+        return -1;
+    while (fscanf(fptr, "%15s %d %d", key, &k, &v) == 3) {
+        if (strcmp(key, "hist") == 0 && k >= 0 && k <= tn) {
+            r->hist[k] = v;
+            r->count += v;
+        }
+        else if (strcmp(key, "log") == 0)
+            add_log_entry(r, k, v);
         else
-            j++;
+            return -1;
     }
-    return count_lines(comp, tn - l);
+    return feof(fptr) ? 0 : -1;
 }
 
-void print_cap_set(int* cs, int csl) {
-    int i, j;
+int compare_ranges(const void* a, const void* b) {
+    return ((int*) a)[0] - ((int*) b)[0];
+}
 
-    for (i = 0; i < csl; i++) {
-        printf("(");
-        for (j = 0; j < n; j++) {
-            printf(j == n-1 ? "%d" : "%d, " , nodes[cs[i]].c[j]);
+// Merges the partial results of the shards of a run and reports them like the run itself would
+int merge_partials(int num_files, char** fnames) {
+    int i, pn, ptrials, covered = 0, * ranges = (int*) malloc(2 * num_files * sizeof(int));
+    uint64_t pseed;
+    results total, part;
+    FILE* fptr;
+
+    for (i = 0; i < num_files; i++) {
+        fptr = fopen(fnames[i], "r");
+        if (!fptr || read_partial_header(fptr, &pn, &pseed, &ptrials, ranges + 2*i, ranges + 2*i + 1) != 0) {
+            printf("%s is not a partial results file\n", fnames[i]);
+            return 1;
         }
-        printf(i == csl - 1 ? ") " : "), ");
+        if (i == 0) {
+            n = pn;
+            seed = pseed;
+            trials = ptrials;
+            if (n < min_n || n > max_n)
+                return 1;
+
+            // Only the dimension is needed, not the table
+            use_table = false;
+            init();
+            init_results(&total);
+        } else if (pn != n || pseed != seed || ptrials != trials) {
+            printf("%s is from a different run (n=%d, seed=%llu, %d trials)\n", fnames[i], pn,
+                (unsigned long long) pseed, ptrials);
+            return 1;
+        }
+
+        init_results(&part);
+        if (read_partial(fptr, &part) != 0) {
+            printf("%s is corrupted\n", fnames[i]);
+            return 1;
+        }
+        fclose(fptr);
+        merge_results(&total, &part);
+        free_results(&part);
     }
-    printf("[Length %d]\n", csl);
+
+    // The shards must cover every trial exactly once
+    qsort(ranges, num_files, 2 * sizeof(int), compare_ranges);
+    for (i = 0; i < num_files; i++) {
+        if (ranges[2*i] > covered) {
+            printf("The shards are missing trials %d to %d\n", covered, ranges[2*i] - 1);
+            return 1;
+        } else if (ranges[2*i] < covered) {
+            printf("The shards overlap on trials %d to %d\n", ranges[2*i], covered - 1);
+            return 1;
+        }
+        covered = ranges[2*i + 1];
+    }
+    if (covered != trials) {
+        printf("The shards are missing trials %d to %d\n", covered, trials - 1);
+        return 1;
+    }
+
+    printf("===== Complete Cap Set (n=%d), %d shards =====\n", n, num_files);
+    printf("%d trials with seed %llu\n", trials, (unsigned long long) seed);
+    print_results(&total);
+    write_histogram(&total);
+    free_results(&total);
+    free(ranges);
+    return 0;
+}
+
+// Restores the results and the next trial to run from the checkpoint, if there is one
+// (the seed is taken from it unless one was given)
+int resume_checkpoint(results* total, bool seed_given) {
+    int pn, ptrials, begin, end;
+    uint64_t pseed;
+    FILE* fptr = fopen(checkpoint_fname, "r");
+
+    if (!fptr) {
+        printf("No checkpoint at %s, starting from the first trial\n", checkpoint_fname);
+        return trial_begin;
+    }
+    if (read_partial_header(fptr, &pn, &pseed, &ptrials, &begin, &end) != 0 || pn != n || ptrials != trials
+        || begin != trial_begin || end < begin || end > trial_end || (seed_given && pseed != seed)
+        || read_partial(fptr, total) != 0) {
+        printf("%s does not match this run\n", checkpoint_fname);
+        exit(1);
+    }
+    fclose(fptr);
+    seed = pseed;
+    printf("Resuming from trial %d\n", end);
+    return end;
+}
+
+// Wall-clock time in seconds (clock() would add up the CPU time of every thread)
+double wall_time() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define ci_z 1.959964  // 95% confidence
+#define min_stop_trials 1000
+
+// Returns the width of the confidence interval of the mean size
+double mean_ci_width(results* r) {
+    moments sizes;
+
+    size_moments(r, &sizes);
+    return 2 * ci_z * sqrt(moments_variance(&sizes) / sizes.count);
+}
+
+// Returns the width of the (Wilson score) confidence interval of the probability of the target size
+double prob_ci_width(results* r) {
+    double count = r->count, p = r->hist[target_size] / count, z2 = ci_z * ci_z;
+
+    return 2 * ci_z * sqrt(p * (1 - p) / count + z2 / (4 * count * count)) / (1 + z2 / count);
+}
+
+// Returns if the estimates the run stops at are precise enough
+bool precise_enough(results* r) {
+    return r->count >= min_stop_trials && (mean_ci <= 0 || mean_ci_width(r) < mean_ci)
+        && (prob_ci <= 0 || prob_ci_width(r) < prob_ci);
 }
 
-void run_trials() {
-    int i, next = 0, inc = trials < 100 ? 1 : trials / 100;
+// Runs trials [from, trial_end) in rounds, adding their results to total,
+// and writes a checkpoint or checks if the run can stop after every round if these are enabled
+void run_trials(results* total, int from) {
+    int i, round_size = trial_chunk * num_threads;
+    bool stopping = mean_ci > 0 || prob_ci > 0, rounds = stopping || checkpoint_secs > 0;
+    double round_start, elapsed;
+    workspace* workspaces = (workspace*) malloc(num_threads * sizeof(workspace));
+    pthread_t* threads = (pthread_t*) malloc(num_threads * sizeof(pthread_t));
+    results snap;
 
-    max_cap_set_len = 0;
-    min_cap_set_len = INT_MAX;
-    for (i = 0; i < trials; i++) {
-        if (i >= next) {
-            printf("\r%d%% complete", 100 * i / trials);
-            next += inc;
+    atomic_store(&next_trial, from);
+    atomic_store(&trials_done, from - trial_begin);
+    for (i = 0; i < num_threads; i++)
+        init_workspace(workspaces + i, i);
+
+    // Without checkpoints or stopping everything is a single round
+    round_end = rounds ? from : trial_end;
+    while (atomic_load(&next_trial) < trial_end) {
+        // When stopping, a round adds a quarter of the trials so far (so it stops at most 25% late)
+        if (stopping) {
+            round_size = (round_end - trial_begin) / 4 > min_stop_trials ? (round_end - trial_begin) / 4 : min_stop_trials;
+            round_size = (round_size + trial_chunk - 1) / trial_chunk * trial_chunk;
         }
+        if (rounds)
+            round_end = trial_end - round_end > round_size ? round_end + round_size : trial_end;
+        round_start = wall_time();
+
+        // The main thread doubles as worker 0
+        for (i = 1; i < num_threads; i++)
+            pthread_create(threads + i, NULL, run_worker, workspaces + i);
+        run_worker(workspaces);
+        for (i = 1; i < num_threads; i++)
+            pthread_join(threads[i], NULL);
 
-        complete_cap_set();
-        
-        data_set(cap_set_len, data_get(cap_set_len) + 1);
-        if (cap_set_len > max_cap_set_len) {
-            memcpy(max_cap_set, cap_set, tn * sizeof(int));
-            max_cap_set_len = cap_set_len;
+        // Every trial before round_end is done, so the results so far can be saved and checked
+        if (rounds) {
+            atomic_store(&next_trial, round_end);
+            init_results(&snap);
+            merge_results(&snap, total);
+            for (i = 0; i < num_threads; i++)
+                merge_results(&snap, &workspaces[i].res);
+            if (stopping && round_end < trial_end && precise_enough(&snap)) {
+                trial_end = round_end;
+                stopped_early = true;
+            }
+            if (checkpoint_secs > 0)
+                write_partial(&snap, checkpoint_fname, round_end);
+            free_results(&snap);
         }
-        if (cap_set_len < min_cap_set_len) {
-            memcpy(min_cap_set, cap_set, tn * sizeof(int));
-            min_cap_set_len = cap_set_len;
+
+        // Otherwise the next round is sized to take about checkpoint_secs
+        if (checkpoint_secs > 0 && !stopping) {
+            elapsed = wall_time() - round_start;
+            if (elapsed < checkpoint_secs / 2.0 && round_size < INT_MAX / 2)
+                round_size *= 2;
+            else if (elapsed > 2.0 * checkpoint_secs && round_size >= 2 * trial_chunk * num_threads)
+                round_size /= 2;
         }
     }
     printf("\r100%% complete\n");
+
+    for (i = 0; i < num_threads; i++) {
+        merge_results(total, &workspaces[i].res);
+        free_workspace(workspaces + i);
+    }
+    free(threads);
+    free(workspaces);
+}
+
+// Picks the engine by dimension unless one was given, once init() knows if the third() table could be opened
+// (the lanes engine needs it, so without it the others are used, with third() computed)
+void choose_engine() {
+    if (engine < 0 && n <= lanes_max_n && third_tab)
+        engine = engine_lanes;
+    else if (engine < 0)
+        engine = n >= counters_min_n ? engine_counters : engine_edges;
+
+    // The lanes engine gives the same cap sets as the others, so single trials are replayed with the counters engine
+    complete_cap_set = kernels[engine == engine_lanes ? engine_counters : engine][n];
+}
+
+void usage(char* prog) {
+    fprintf(stderr, "Usage: %s [-n dimension] [-t trials] [--seed S] [--threads N] [--no-table] [--no-simd]\n", prog);
+    fprintf(stderr, "       %*s [--log FILE] [--log-per-size K] [--replay k] [--caps FILE] [--read-caps FILE] [--lines]\n",
+        (int) strlen(prog), "");
+    fprintf(stderr, "       %*s [--engine edges|counters|lanes] [--shard k/K] [--checkpoint SECS] [--resume]\n",
+        (int) strlen(prog), "");
+    fprintf(stderr, "       %*s [--mean-ci W] [--prob-ci W] [--target-size K]\n", (int) strlen(prog), "");
+    fprintf(stderr, "       %s --merge FILE...\n", prog);
+    exit(1);
 }
 
-int main() {
-    int i, sum = 0, max_occur = 0;
+int main(int argc, char** argv) {
+    int i, from, cards, replay = -1;
+    bool seed_given = false, resume = false;
     char fname[100];
-    FILE* fptr;
-    clock_t start;
+    double start;
+    results total;
+
+    seed = (uint64_t) time(NULL);
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i+1 < argc)
+            n = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i+1 < argc)
+            trials = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+            seed_given = true;
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i+1 < argc)
+            num_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--no-table") == 0)
+            use_table = false;
+        else if (strcmp(argv[i], "--no-simd") == 0)
+            use_simd = false;
+        else if (strcmp(argv[i], "--log") == 0 && i+1 < argc)
+            log_fname = argv[++i];
+        else if (strcmp(argv[i], "--log-per-size") == 0 && i+1 < argc)
+            log_per_size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--replay") == 0 && i+1 < argc)
+            replay = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--caps") == 0 && i+1 < argc)
+            caps_fname = argv[++i];
+        else if (strcmp(argv[i], "--engine") == 0 && i+1 < argc) {
+            i++;
+            if (strcmp(argv[i], "edges") == 0)
+                engine = engine_edges;
+            else if (strcmp(argv[i], "counters") == 0)
+                engine = engine_counters;
+            else if (strcmp(argv[i], "lanes") == 0)
+                engine = engine_lanes;
+            else
+                usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--lines") == 0)
+            count_complement_lines = true;
+        else if (strcmp(argv[i], "--read-caps") == 0 && i+1 < argc)
+            return read_caps(argv[++i]);
+        else if (strcmp(argv[i], "--shard") == 0 && i+1 < argc) {
+            if (sscanf(argv[++i], "%d/%d", &shard, &num_shards) != 2)
+                usage(argv[0]);
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i+1 < argc)
+            checkpoint_secs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--resume") == 0)
+            resume = true;
+        else if (strcmp(argv[i], "--mean-ci") == 0 && i+1 < argc)
+            mean_ci = atof(argv[++i]);
+        else if (strcmp(argv[i], "--prob-ci") == 0 && i+1 < argc)
+            prob_ci = atof(argv[++i]);
+        else if (strcmp(argv[i], "--target-size") == 0 && i+1 < argc)
+            target_size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--merge") == 0 && i+1 < argc)
+            return merge_partials(argc - i - 1, argv + i + 1);
+        else
+            usage(argv[0]);
+    }
+    if (n < min_n || n > max_n || trials < 1 || num_threads < 1 || num_shards < 1 || num_shards > trials
+        || shard < 0 || shard >= num_shards)
+        usage(argv[0]);
+    for (cards = 1, i = 0; i < n; i++)
+        cards *= 3;
+    if (target_size > cards) {
+        fprintf(stderr, "The target size cannot be more than the %d cards of n=%d\n", cards, n);
+        return 1;
+    }
+    if (target_size < 0 && n < 7)
+        target_size = known_max[n];
+    if (prob_ci > 0 && target_size < 0) {
+        fprintf(stderr, "--prob-ci needs a target size (--target-size) when n >= 7\n");
+        return 1;
+    }
+    if ((mean_ci > 0 || prob_ci > 0) && num_shards > 1) {
+        fprintf(stderr, "Shards cannot stop early, since they would no longer cover every trial\n");
+        return 1;
+    }
+    trial_begin = (long long) trials * shard / num_shards;
+    trial_end = (long long) trials * (shard + 1) / num_shards;
+    if (num_shards > 1)
+        snprintf(checkpoint_fname, 100, "data/n%d_t%d.part%d_of_%d.ckpt", n, trials, shard, num_shards);
+    else
+        snprintf(checkpoint_fname, 100, "data/n%d_t%d.ckpt", n, trials);
+
+    if (replay >= 0) {
+        init();
+        choose_engine();
+        third_batch_init(use_simd);
+        replay_trial(replay);
+        return 0;
+    }
 
     printf("===== Complete Cap Set (n=%d) =====\n", n);
 
     printf("Initializing...\n");
     init();
+    if (engine == engine_lanes && !third_tab) {
+        printf("The lanes engine needs the third() table (n <= %d)\n", table_max_n);
+        return 1;
+    }
+    choose_engine();
+    printf("Engine: %s", engine_names[engine]);
+    if (engine == engine_lanes)
+        printf(" (%s)", lanes_select(use_simd));
+    printf(", batched third(): %s, table: %s\n", third_batch_init(use_simd), third_tab ? "yes" : "no");
+    init_results(&total);
+    from = resume ? resume_checkpoint(&total, seed_given) : trial_begin;
+    log_base_hist = total.hist;
 
-    printf("Executing %d trials...\n", trials);
-    start = clock();
-    run_trials();
-    printf("Time elapsed: %.5fs\n", (double) (clock() - start) / CLOCKS_PER_SEC);
-
-    printf("Smallest cap set found: %d\n", min_cap_set_len);
-    printf("Largest cap set found: %d\n", max_cap_set_len);
-
-    for (i = 0; i < map_size; i++) {
-        sum += data_keys[i] * data_vals[i];
-        if (n < 7 && data_keys[i] == known_max[n])
-            max_occur += data_vals[i];
+    if (num_shards > 1) {
+        printf("Shard %d of %d: trials %d to %d of %d\n", shard, num_shards, trial_begin, trial_end - 1, trials);
+    }
+    printf("Executing %d trials on %d thread(s) with seed %llu...\n", trial_end - from, num_threads,
+        (unsigned long long) seed);
+    if (caps_fname && cap_stream_open(&caps, caps_fname, n, seed, from, trial_end - from) != 0) {
+        printf("Could not write %s\n", caps_fname);
+        caps_fname = NULL;
+    }
+    start = wall_time();
+    run_trials(&total, from);
+    if (caps_fname && cap_stream_close(&caps, trial_end - from) != 0)
+        printf("Error writing %s\n", caps_fname);
+    printf("Time elapsed: %.5fs\n", wall_time() - start);
+    if (stopped_early) {
+        printf("Stopped early after %d trials\n", trial_end);
+        trials = trial_end;
+    }
+    if (mean_ci > 0 || prob_ci > 0) {
+        printf("95%% confidence interval width of the mean size: %.5f", mean_ci_width(&total));
+        if (target_size >= 0)
+            printf(", of the probability of size %d: %.5f", target_size, prob_ci_width(&total));
+        printf("\n");
     }
-    printf("Number of maximum cap sets: %d (probability %.5f)\n", max_occur, (float) max_occur / trials);
-    printf("Average cap set size: %.5f\n", (float) sum / trials);
 
-    snprintf(fname, 100, "data/n%d_t%d.txt", n, trials);
-    fptr = fopen(fname, "w");
-    for (i = 0; i < map_size; i++)
-        if (data_keys[i] != 0)
-            fprintf(fptr, "%d: %d\n", data_keys[i], data_vals[i]);
-    fclose(fptr);
-}
\ No newline at end of file
+    print_results(&total);
+    if (num_shards > 1) {
+        snprintf(fname, 100, "data/n%d_t%d.part%d_of_%d", n, trials, shard, num_shards);
+        write_partial(&total, fname, trial_end);
+    } else {
+        write_histogram(&total);
+    }
+    if (log_fname)
+        write_log(&total);
+    free_results(&total);
+}
@@ -0,0 +1,147 @@
+/*
+The greedy algorithm specialized for a single dimension.
+
+greedy_cap_sets.c includes this file once for every supported dimension with n and tn defined
+as constants, so that every loop bound and card length below is known at compile time.
+Each inclusion defines two kernels that run one trial on a workspace, one per engine:
+    complete_cap_set_edges_<n>()     stores the edges in the arena and walks them on elimination
+    complete_cap_set_counters_<n>()  keeps only the in-degrees and recomputes the edges from the cap set
+*/
+
+#define KERNEL_CAT2(a, b) a##_##b
+#define KERNEL_CAT(a, b) KERNEL_CAT2(a, b)
+#define KERNEL(name) KERNEL_CAT(name, n)
+
+#define third KERNEL(third)
+#define third_alive KERNEL(third_alive)
+#define reinit KERNEL(reinit)
+#define elim KERNEL(elim)
+#define greedy KERNEL(greedy)
+
+// Returns the index of the card that forms a set with i1 and i2
+// (rows of the table are contiguous, so i1 should be the card that varies least)
+static inline int third(int i1, int i2) {
+    if (n <= table_max_n && third_tab)
+        return third_tab[i1*tn + i2];
+    return packed_index(packed_third(codes[i1], codes[i2]), n);
+}
+
+// Computes thirds[k] = third(i, alive[k]) for every alive card in one batch
+static inline void third_alive(workspace* ws, int i) {
+    if (n <= table_max_n && third_tab)
+        third_batch_table(third_tab + i*tn, ws->alive, ws->alive_len, ws->thirds);
+    else
+        third_batch_packed(codes32[i], codes32, ws->alive, ws->alive_len, ws->thirds, n);
+}
+
+// Resets graph
+static inline void reinit(workspace* ws, bool implicit_edges) {
+    int i;
+
+    rng_shuffle(&ws->rng, ws->ord, tn);
+    memcpy(ws->alive, ws->ord, tn * sizeof(int));
+    ws->alive_len = tn;
+    bitset_fill(ws->alive_bits, tn);
+    ws->cap_set_len = 0;
+    ws->arena_len = 0;
+
+    for (i = 0; i < tn; i++) {
+        ws->alive_rank[i] = i;
+        ws->alive_pos[ws->ord[i]] = i;
+    }
+    memset(ws->in_deg, 0, tn * sizeof(int));
+    if (!implicit_edges) {
+        memset(ws->edge_len, 0, tn * sizeof(int));
+        memset(ws->edge_cap, 0, tn * sizeof(int));
+    }
+}
+
+// Eliminates a node and updates the in-degrees of its neighbors
+static inline void elim(workspace* ws, int i, bool implicit_edges) {
+    int j, u, p = ws->alive_pos[i], last = ws->alive_len - 1;
+
+    // Swap-remove i from the alive array
+    bitset_reset(ws->alive_bits, i);
+    ws->alive[p] = ws->alive[last];
+    ws->alive_rank[p] = ws->alive_rank[last];
+    ws->alive_pos[ws->alive[p]] = p;
+    ws->alive_len--;
+
+    if (implicit_edges) {
+        // Every card c in the cap set built an edge (i -> third(c, i)) if that card is still alive
+        for (j = 0; j < ws->cap_set_len; j++) {
+            u = third(i, ws->cap_set[j]);
+            if (bitset_test(ws->alive_bits, u))
+                ws->in_deg[u]--;
+        }
+    } else {
+        for (j = 0; j < ws->edge_len[i]; j++)
+            ws->in_deg[ws->arena[ws->edges[i] + j]]--;
+    }
+}
+
+// The greedy algorithm, inlined into each engine's kernel with implicit_edges constant
+static inline __attribute__((always_inline)) void greedy(workspace* ws, bool implicit_edges) {
+    int i, u, d, best_count, best_rank, best_index, next_index, to_elim;
+    int* in_deg = ws->in_deg;
+
+    reinit(ws, implicit_edges);
+
+    // Every in-degree starts at 0, so the first card in the shuffled order eliminates the fewest new cards
+    best_index = ws->ord[0];
+    do {
+        // Eliminate cards that form a line with the card at best_index
+        // and some other card in the cap set so far
+        elim(ws, best_index, implicit_edges);
+        for (i = 0; i < ws->cap_set_len; i++) {
+            to_elim = third(best_index, ws->cap_set[i]);
+            if (bitset_test(ws->alive_bits, to_elim))
+                elim(ws, to_elim, implicit_edges);
+        }
+        third_alive(ws, best_index);
+
+        // Update eliminators/adjacency
+        // and find the card that eliminates the fewest new cards
+        best_count = best_rank = INT_MAX;
+        next_index = -1;
+        for (i = 0; i < ws->alive_len; i++) {
+            u = ws->alive[i];
+            to_elim = ws->thirds[i];
+            if (bitset_test(ws->alive_bits, to_elim)) {
+                if (implicit_edges)
+                    in_deg[u]++;
+                else
+                    add_neighbor(ws, to_elim, u);
+            }
+
+            // The in-degree of u is final for this step
+            d = in_deg[u];
+            if (d < best_count || (d == best_count && ws->alive_rank[i] < best_rank)) {
+                best_count = d;
+                best_rank = ws->alive_rank[i];
+                next_index = u;
+            }
+        }
+
+        ws->cap_set[ws->cap_set_len] = best_index;
+        ws->cap_set_len++;
+        best_index = next_index;
+    } while (ws->alive_len > 0);
+}
+
+void KERNEL(complete_cap_set_edges)(workspace* ws) {
+    greedy(ws, false);
+}
+
+void KERNEL(complete_cap_set_counters)(workspace* ws) {
+    greedy(ws, true);
+}
+
+#undef third
+#undef third_alive
+#undef reinit
+#undef elim
+#undef greedy
+#undef KERNEL
+#undef KERNEL_CAT
+#undef KERNEL_CAT2
@@ -0,0 +1,229 @@
+/*
+The lanes engine: LANES greedy trials run in lock-step, one per lane.
+
+In small dimensions a trial is a few dozen short steps, so the time goes into per-trial overhead
+and the unpredictable branches of the edge-building pass rather than into the work itself.
+Here the state of every lane sits side by side for each card (in_deg[u*LANES + l] and so on),
+so the edge-building pass and the search for the card with the smallest in-degree handle
+every lane at once: one AVX2 instruction per card and operation, with masks for dead cards.
+A lane that finishes its trial starts the next one right away, so the lanes stay busy.
+
+It is the counters-only engine (see greedy_kernel.h) with every alive card visited in index order,
+so the in-degrees are kept in the key (in_deg << 16) | rank, and the smallest key of a lane
+breaks ties by the shuffled order exactly as the other engines do: every trial gives the same cap set.
+Elimination still runs lane by lane, since it only touches a few cards.
+
+third() is looked up in the precomputed table (see third_table.h),
+which also keeps 3^n within the 16 bits of the rank.
+Call lanes_select() before lanes_run().
+*/
+
+#ifndef GREEDY_LANES_H
+#define GREEDY_LANES_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rng.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define LANES_X86 1
+#else
+#define LANES_X86 0
+#endif
+
+#define LANES 8
+
+typedef struct lanes_struct {
+    int tn;
+    const uint16_t* tab;  // third(u, v) = tab[v*tn + u]
+    int32_t* alive;  // alive[u*LANES + l] = -1 if card u is alive in lane l, 0 otherwise
+    int32_t* in_deg;  // in_deg[u*LANES + l]
+    int32_t* rank;  // rank[u*LANES + l] = position of card u in the shuffled order of lane l
+    int* ord;  // ord[l*tn + r] = card at position r of the shuffled order of lane l
+    int* cap;  // cap[l*tn + k] = k-th card of the cap set of lane l
+    int cap_len[LANES], alive_len[LANES], trial[LANES];
+    int32_t cur[LANES], next[LANES];  // Card each lane adds in this step and in the next (-1 if none)
+    rng rng;
+} lanes;
+
+static void lanes_init(lanes* s, int tn, const uint16_t* tab) {
+    s->tn = tn;
+    s->tab = tab;
+    s->alive = (int32_t*) calloc(tn * LANES, sizeof(int32_t));
+    s->in_deg = (int32_t*) malloc(tn * LANES * sizeof(int32_t));
+    s->rank = (int32_t*) malloc(tn * LANES * sizeof(int32_t));
+    s->ord = (int*) malloc(tn * LANES * sizeof(int));
+    s->cap = (int*) malloc(tn * LANES * sizeof(int));
+}
+
+static void lanes_free(lanes* s) {
+    free(s->alive);
+    free(s->in_deg);
+    free(s->rank);
+    free(s->ord);
+    free(s->cap);
+}
+
+// Starts the given trial in lane l
+static void lanes_start(lanes* s, int l, uint64_t seed, int trial) {
+    int i, tn = s->tn, * ord = s->ord + l*tn;
+
+    rng_seed(&s->rng, seed, trial);
+    rng_shuffle(&s->rng, ord, tn);
+    for (i = 0; i < tn; i++) {
+        s->rank[ord[i]*LANES + l] = i;
+        s->alive[i*LANES + l] = -1;
+        s->in_deg[i*LANES + l] = 0;
+    }
+    s->alive_len[l] = tn;
+    s->cap_len[l] = 0;
+    s->trial[l] = trial;
+
+    // Every in-degree starts at 0, so the first card in the shuffled order eliminates the fewest new cards
+    s->cur[l] = ord[0];
+}
+
+// Eliminates card i in lane l and updates the in-degrees of the cards it eliminated
+static inline void lanes_elim(lanes* s, int l, int i) {
+    int j, u, * cap = s->cap + l*s->tn;
+
+    s->alive[i*LANES + l] = 0;
+    s->alive_len[l]--;
+    for (j = 0; j < s->cap_len[l]; j++) {
+        u = s->tab[cap[j]*s->tn + i];
+        s->in_deg[u*LANES + l] += s->alive[u*LANES + l];  // Decrements it only if u is alive
+    }
+}
+
+// Edge-building pass of every lane: counts the new card cur[l] in the in-degrees of lane l,
+// and sets next[l] to the alive card with the smallest in-degree (-1 if none is alive)
+static void lanes_pass_scalar(lanes* s) {
+    int u, l, tn = s->tn;
+    int32_t key, best[LANES];
+
+    for (l = 0; l < LANES; l++)
+        best[l] = INT_MAX;
+    for (u = 0; u < tn; u++) {
+        for (l = 0; l < LANES; l++) {
+            if (!s->alive[u*LANES + l])
+                continue;
+            if (s->alive[s->tab[s->cur[l]*tn + u]*LANES + l])
+                s->in_deg[u*LANES + l]++;
+            key = (s->in_deg[u*LANES + l] << 16) | s->rank[u*LANES + l];
+            if (key < best[l])
+                best[l] = key;
+        }
+    }
+    for (l = 0; l < LANES; l++)
+        s->next[l] = best[l] == INT_MAX ? -1 : s->ord[l*tn + (best[l] & 0xffff)];
+}
+
+#if LANES_X86
+
+__attribute__((target("avx2")))
+static void lanes_pass_avx2(lanes* s) {
+    int u, l, tn = s->tn;
+    int32_t best[LANES];
+    __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), low = _mm256_set1_epi32(0xffff);
+    __m256i none = _mm256_set1_epi32(INT_MAX), min = none, zero = _mm256_setzero_si256();
+    __m256i cur, row, a, t, d, key;
+
+    // Idle lanes (cur[l] = -1) have no alive cards, so every one of their loads below is masked off
+    cur = _mm256_max_epi32(_mm256_loadu_si256((const __m256i*) s->cur), zero);
+    row = _mm256_mullo_epi32(cur, _mm256_set1_epi32(tn));
+    for (u = 0; u < tn; u++) {
+        a = _mm256_loadu_si256((const __m256i*) (s->alive + u*LANES));
+        if (_mm256_testz_si256(a, a))
+            continue;
+
+        // t = third(cur, u) and then whether it is alive, in every lane where u is alive
+        t = _mm256_add_epi32(row, _mm256_set1_epi32(u));
+        t = _mm256_mask_i32gather_epi32(zero, (const int*) s->tab, t, a, 2);
+        t = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(t, low), 3), lane);
+        t = _mm256_mask_i32gather_epi32(zero, (const int*) s->alive, t, a, 4);
+
+        // The mask is -1 where both are alive
+        d = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) (s->in_deg + u*LANES)), t);
+        _mm256_storeu_si256((__m256i*) (s->in_deg + u*LANES), d);
+        key = _mm256_or_si256(_mm256_slli_epi32(d, 16), _mm256_loadu_si256((const __m256i*) (s->rank + u*LANES)));
+        min = _mm256_min_epi32(min, _mm256_blendv_epi8(none, key, a));
+    }
+
+    _mm256_storeu_si256((__m256i*) best, min);
+    for (l = 0; l < LANES; l++)
+        s->next[l] = best[l] == INT_MAX ? -1 : s->ord[l*tn + (best[l] & 0xffff)];
+}
+
+#endif
+
+static void (*lanes_pass)(lanes* s) = lanes_pass_scalar;
+
+// Selects the fastest pass supported by the CPU (returns its name)
+static const char* lanes_select(bool allow_simd) {
+#if LANES_X86
+    __builtin_cpu_init();
+    if (allow_simd && __builtin_cpu_supports("avx2")) {
+        lanes_pass = lanes_pass_avx2;
+        return "avx2";
+    }
+#endif
+    lanes_pass = lanes_pass_scalar;
+    return "scalar";
+}
+
+// Runs trials [start, end), writing the cap set of trial i to caps + (i - start)*tn and its length to lens[i - start]
+static void lanes_run(lanes* s, uint64_t seed, int start, int end, int* caps, int* lens) {
+    int i, l, v, tn = s->tn, next_trial = start, active = 0, * cap;
+
+    for (l = 0; l < LANES; l++) {
+        if (next_trial < end) {
+            lanes_start(s, l, seed, next_trial++);
+            active++;
+        } else {
+            s->cur[l] = -1;
+        }
+    }
+
+    while (active > 0) {
+        // Eliminate the card each lane adds and the cards that form a line with it and the cap set so far
+        for (l = 0; l < LANES; l++) {
+            if ((v = s->cur[l]) < 0)
+                continue;
+            cap = s->cap + l*tn;
+            lanes_elim(s, l, v);
+            for (i = 0; i < s->cap_len[l]; i++) {
+                if (s->alive[s->tab[v*tn + cap[i]]*LANES + l])
+                    lanes_elim(s, l, s->tab[v*tn + cap[i]]);
+            }
+        }
+
+        lanes_pass(s);
+
+        for (l = 0; l < LANES; l++) {
+            if ((v = s->cur[l]) < 0)
+                continue;
+            cap = s->cap + l*tn;
+            cap[s->cap_len[l]++] = v;
+            s->cur[l] = s->next[l];
+            if (s->alive_len[l] > 0)
+                continue;
+
+            // The trial is done, so hand the lane to the next one
+            memcpy(caps + (s->trial[l] - start)*tn, cap, s->cap_len[l] * sizeof(int));
+            lens[s->trial[l] - start] = s->cap_len[l];
+            if (next_trial < end) {
+                lanes_start(s, l, seed, next_trial++);
+            } else {
+                s->cur[l] = -1;
+                active--;
+            }
+        }
+    }
+}
+
+#endif
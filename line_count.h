@@ -0,0 +1,78 @@
+/*
+Counting the lines in a set of cards with the Fourier transform over Z_3^n.
+
+Let f be the indicator of a set A and f^(x) = sum of w^(x . a) over a in A, where w = e^(2 pi i / 3).
+The number of ordered triples (a, b, c) of A with a + b + c = 0 is then T = 3^-n * sum of f^(x)^3 over x.
+a + b + c = 0 with a = b forces c = a, so T counts each card once as (a, a, a)
+and each line 3! times as three distinct cards, and the number of lines is (T - |A|) / 6.
+
+The transform is a radix-3 FFT over the base-3 digits of the card indices, O(n 3^n) in total,
+so it pays off for large sets (such as the complement of a cap set) where checking every pair is O(|A|^2).
+Values are kept exactly in Z[w] as a + b w (with w^2 = -1 - w) using 64-bit integers.
+Intermediate sums may overflow, but they wrap around modulo 2^64 and the final count fits,
+so the arithmetic is done in uint64_t and the result is still exact.
+*/
+
+#ifndef LINE_COUNT_H
+#define LINE_COUNT_H
+
+#include <stdint.h>
+
+#include "bitset.h"
+
+// Multiplies a + b w by w
+#define LINE_COUNT_MUL_W(a, b, ra, rb) do { uint64_t t_ = (a); (ra) = -(b); (rb) = t_ - (b); } while (0)
+
+// Returns the number of lines in a set of cards given as a bitset (see bitset.h),
+// using work as scratch space for 2 * 3^n values
+// (n <= 12, so that 3^n T fits)
+static int64_t line_count_fourier(const uint64_t* bits, int tn, uint64_t* work) {
+    uint64_t a0, b0, a1, b1, a2, b2, wa1, wb1, wa2, wb2, w2a1, w2b1, w2a2, w2b2, sa, sb, total = 0;
+    int s, k, j;
+
+    for (k = 0; k < tn; k++) {
+        work[2*k] = bitset_test(bits, k);
+        work[2*k + 1] = 0;
+    }
+
+    // One pass of 3-point butterflies per coordinate
+    for (s = 1; s < tn; s *= 3) {
+        for (k = 0; k < tn; k += 3*s) {
+            for (j = k; j < k + s; j++) {
+                a0 = work[2*j];
+                b0 = work[2*j + 1];
+                a1 = work[2*(j + s)];
+                b1 = work[2*(j + s) + 1];
+                a2 = work[2*(j + 2*s)];
+                b2 = work[2*(j + 2*s) + 1];
+                LINE_COUNT_MUL_W(a1, b1, wa1, wb1);
+                LINE_COUNT_MUL_W(wa1, wb1, w2a1, w2b1);
+                LINE_COUNT_MUL_W(a2, b2, wa2, wb2);
+                LINE_COUNT_MUL_W(wa2, wb2, w2a2, w2b2);
+                work[2*j] = a0 + a1 + a2;
+                work[2*j + 1] = b0 + b1 + b2;
+                work[2*(j + s)] = a0 + wa1 + w2a2;
+                work[2*(j + s) + 1] = b0 + wb1 + w2b2;
+                work[2*(j + 2*s)] = a0 + w2a1 + wa2;
+                work[2*(j + 2*s) + 1] = b0 + w2b1 + wb2;
+            }
+        }
+    }
+
+    // The sum of the cubes is real, so only the rational parts of the cubes are needed
+    // ((a + b w)^2 = a^2 - b^2 + (2ab - b^2) w, and (c + d w)(a + b w) = ca - db + (cb + da - db) w)
+    for (k = 0; k < tn; k++) {
+        a0 = work[2*k];
+        b0 = work[2*k + 1];
+        sa = a0*a0 - b0*b0;
+        sb = 2*a0*b0 - b0*b0;
+        total += sa*a0 - sb*b0;
+    }
+
+    // work[0] is f^(0) = |A|
+    return ((int64_t) total / tn - (int64_t) work[0]) / 6;
+}
+
+#undef LINE_COUNT_MUL_W
+
+#endif
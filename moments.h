@@ -0,0 +1,66 @@
+/*
+Streaming mean, variance and skewness of a sequence of values (Welford's algorithm,
+extended to the third central moment as in Pébay, "Formulas for robust, one-pass parallel
+computation of covariances and arbitrary-order statistical moments", 2008).
+
+Adding a value is O(1), and the moments of two sequences can be merged into the moments
+of their concatenation, so every worker keeps its own and they are combined at the end.
+*/
+
+#ifndef MOMENTS_H
+#define MOMENTS_H
+
+#include <math.h>
+
+typedef struct moments_struct {
+    long count;
+    double mean, m2, m3;  // m2 and m3 are sums of squared/cubed deviations from the mean
+} moments;
+
+static inline void moments_init(moments* m) {
+    m->count = 0;
+    m->mean = m->m2 = m->m3 = 0;
+}
+
+static inline void moments_add(moments* m, double x) {
+    long n1 = m->count;
+    double delta, dn, term;
+
+    m->count++;
+    delta = x - m->mean;
+    dn = delta / m->count;
+    term = delta * dn * n1;
+    m->mean += dn;
+    m->m3 += term * dn * (m->count - 2) - 3 * dn * m->m2;
+    m->m2 += term;
+}
+
+// Adds the moments of src into dst
+static inline void moments_merge(moments* dst, const moments* src) {
+    double na = dst->count, nb = src->count, n = na + nb, delta;
+
+    if (src->count == 0)
+        return;
+    if (dst->count == 0) {
+        *dst = *src;
+        return;
+    }
+    delta = src->mean - dst->mean;
+    dst->m3 += src->m3 + delta * delta * delta * na * nb * (na - nb) / (n * n)
+        + 3 * delta * (na * src->m2 - nb * dst->m2) / n;
+    dst->m2 += src->m2 + delta * delta * na * nb / n;
+    dst->mean += delta * nb / n;
+    dst->count += src->count;
+}
+
+// Sample variance
+static inline double moments_variance(const moments* m) {
+    return m->count > 1 ? m->m2 / (m->count - 1) : 0;
+}
+
+// Skewness g1 = sqrt(n) m3 / m2^(3/2) (0 if every value is the same)
+static inline double moments_skewness(const moments* m) {
+    return m->m2 > 0 ? sqrt((double) m->count) * m->m3 / pow(m->m2, 1.5) : 0;
+}
+
+#endif
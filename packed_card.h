@@ -0,0 +1,96 @@
+/*
+Packed encoding of the cards of Z_3^n, shared by greedy_cap_sets.c and all/all_caps.c.
+
+A card is packed into a 64-bit word holding two bit-planes:
+bit i of the low half is set if coordinate i is 1, and bit i of the high half is set if coordinate i is 2.
+This supports up to 32 dimensions.
+The third card of a line is then a handful of bitwise operations on the planes,
+instead of a setter[][] lookup per coordinate.
+
+Packed cards are converted to and from their dense base-3 index (the index of the card
+interpreted in base-3, least significant coordinate first) with small tables,
+a byte of each plane or six coordinates at a time. Call packed_init() before converting.
+*/
+
+#ifndef PACKED_CARD_H
+#define PACKED_CARD_H
+
+#include <stdint.h>
+
+typedef uint64_t packed_card;
+
+#define PACKED_MAX_N 32
+#define PACKED_LOW 0xffffffffULL
+
+// Base-3 value of the coordinates marked by the bits of a byte
+static uint32_t packed_byte_index[256];
+
+// Packed card of every base-3 index below 3^6
+static packed_card packed_chunk[729];
+
+// Powers of 3^8, the weight of the k-th byte of a plane
+static uint32_t packed_byte_weight[4];
+
+static void packed_init() {
+    int i, j, k, d;
+
+    for (i = 0; i < 256; i++) {
+        packed_byte_index[i] = 0;
+        for (j = 7; j >= 0; j--)
+            packed_byte_index[i] = 3 * packed_byte_index[i] + ((i >> j) & 1);
+    }
+
+    for (i = 0; i < 729; i++) {
+        packed_chunk[i] = 0;
+        for (j = 0, k = i; j < 6; j++, k /= 3) {
+            d = k % 3;
+            if (d == 1)
+                packed_chunk[i] |= 1ULL << j;
+            else if (d == 2)
+                packed_chunk[i] |= 1ULL << (j + 32);
+        }
+    }
+
+    packed_byte_weight[0] = 1;
+    for (i = 1; i < 4; i++)
+        packed_byte_weight[i] = 6561 * packed_byte_weight[i-1];
+}
+
+// Returns the packed card w such that (u, v, w) forms a line, i.e. w = -(u + v) coordinate-wise
+static inline packed_card packed_third(packed_card u, packed_card v) {
+    uint64_t u1 = u & PACKED_LOW, u2 = u >> 32, v1 = v & PACKED_LOW, v2 = v >> 32;
+    uint64_t u0 = ~(u1 | u2), v0 = ~(v1 | v2);
+
+    // Unused coordinates are 0 in both cards, so they stay 0
+    return ((u1 & v1) | (u0 & v2) | (u2 & v0))
+        | (((u2 & v2) | (u0 & v1) | (u1 & v0)) << 32);
+}
+
+// Returns coordinate i of a packed card
+static inline int packed_digit(packed_card c, int i) {
+    return ((c >> i) & 1) + 2 * ((c >> (i + 32)) & 1);
+}
+
+// Returns the base-3 index of a packed card with n coordinates (n <= 20 so that it fits)
+static inline uint32_t packed_index(packed_card c, int n) {
+    uint32_t res = 0;
+    int k;
+
+    for (k = 0; 8*k < n; k++) {
+        res += packed_byte_weight[k]
+            * (packed_byte_index[(c >> 8*k) & 0xff] + 2 * packed_byte_index[(c >> (8*k + 32)) & 0xff]);
+    }
+    return res;
+}
+
+// Returns the packed card with base-3 index i
+static inline packed_card packed_from_index(uint64_t i) {
+    packed_card res = 0;
+    int shift;
+
+    for (shift = 0; i > 0; shift += 6, i /= 729)
+        res |= packed_chunk[i % 729] << shift;
+    return res;
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+Random numbers for the greedy trials: xoshiro256** (Blackman and Vigna).
+
+Every trial gets its own stream, seeded from the run's seed and the trial's index through splitmix64.
+Any trial can therefore be run on any worker (or replayed later) and still see exactly the same numbers,
+without stepping through the streams of the trials before it.
+*/
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+typedef struct rng_struct {
+    uint64_t s[4];
+} rng;
+
+static inline uint64_t rng_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t splitmix64(uint64_t* x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Seeds r with the stream of the given trial of a run
+static inline void rng_seed(rng* r, uint64_t seed, uint64_t trial) {
+    uint64_t x = seed;
+    int i;
+
+    // Mix the seed first so that nearby seeds and trials do not give overlapping splitmix64 sequences
+    x = splitmix64(&x) ^ trial * 0xd1b54a32d192ed03ULL;
+    for (i = 0; i < 4; i++)
+        r->s[i] = splitmix64(&x);
+}
+
+static inline uint64_t rng_next(rng* r) {
+    uint64_t* s = r->s;
+    uint64_t res = rng_rotl(s[1] * 5, 7) * 9, t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 45);
+    return res;
+}
+
+// Returns a uniformly random integer in [0, bound) without modulo bias (Lemire's method)
+static inline uint32_t rng_below(rng* r, uint32_t bound) {
+    uint64_t m = (rng_next(r) >> 32) * bound;
+    uint32_t t;
+
+    if ((uint32_t) m < bound) {
+        t = -bound % bound;
+        while ((uint32_t) m < t)
+            m = (rng_next(r) >> 32) * bound;
+    }
+    return m >> 32;
+}
+
+// Fills a with a uniformly random permutation of 0, ..., l-1
+// (inside-out Fisher-Yates, so the result only depends on the random stream and not on what a held before)
+static inline void rng_shuffle(rng* r, int* a, int l) {
+    int i, j;
+
+    for (i = 0; i < l; i++) {
+        j = rng_below(r, i+1);
+        a[i] = a[j];
+        a[j] = i;
+    }
+}
+
+#endif
@@ -0,0 +1,133 @@
+/*
+Batched third(): the third cards of the lines through one fixed card and each card of an array.
+
+This is the inner loop of the greedy edge-building pass, so it has an AVX2 version
+that handles 8 cards per instruction, selected at runtime by third_batch_init(),
+and a scalar fallback for other CPUs.
+Two variants are provided:
+    third_batch_table()   looks the thirds up in a row of the precomputed table (see third_table.h)
+    third_batch_packed()  computes them from packed cards narrowed to 32 bits
+                          (the low 16 bits hold the 1-plane and the high 16 bits the 2-plane, so n <= 16)
+Call packed_init() before third_batch_init().
+*/
+
+#ifndef THIRD_BATCH_H
+#define THIRD_BATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "packed_card.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define THIRD_BATCH_X86 1
+#else
+#define THIRD_BATCH_X86 0
+#endif
+
+// Narrows a packed card with at most 16 coordinates to 32 bits
+static inline uint32_t packed_narrow(packed_card c) {
+    return (uint32_t) (c & 0xffff) | (uint32_t) ((c >> 32) << 16);
+}
+
+// out[k] = row[cards[k]] for k < len
+static void third_batch_table_scalar(const uint16_t* row, const int* cards, int len, int* out) {
+    int k;
+
+    for (k = 0; k < len; k++)
+        out[k] = row[cards[k]];
+}
+
+// out[k] = third(c, cards[k]) for k < len, where c is the narrowed packed card of the fixed card
+// and codes holds the narrowed packed card of every card
+static void third_batch_packed_scalar(uint32_t c, const uint32_t* codes, const int* cards, int len, int* out, int n) {
+    uint32_t u1 = c & 0xffff, u2 = c >> 16, u0 = ~(u1 | u2), v, v1, v2, v0, w1, w2;
+    int k;
+
+    for (k = 0; k < len; k++) {
+        v = codes[cards[k]];
+        v1 = v & 0xffff;
+        v2 = v >> 16;
+        v0 = ~(v1 | v2);
+        w1 = ((u1 & v1) | (u0 & v2) | (u2 & v0)) & 0xffff;
+        w2 = ((u2 & v2) | (u0 & v1) | (u1 & v0)) & 0xffff;
+        out[k] = packed_byte_index[w1 & 0xff] + 2 * packed_byte_index[w2 & 0xff];
+        if (n > 8)
+            out[k] += 6561 * (packed_byte_index[w1 >> 8] + 2 * packed_byte_index[w2 >> 8]);
+    }
+}
+
+#if THIRD_BATCH_X86
+
+// The table is read with 32-bit gathers, so row[cards[k] + 1] must be readable too
+// (always true in the greedy pass: the last entry of the table is third(3^n-1, 3^n-1),
+// which is never looked up since a card is never alive once it is in the cap set)
+__attribute__((target("avx2")))
+static void third_batch_table_avx2(const uint16_t* row, const int* cards, int len, int* out) {
+    __m256i mask = _mm256_set1_epi32(0xffff), idx;
+    int k;
+
+    for (k = 0; k + 8 <= len; k += 8) {
+        idx = _mm256_loadu_si256((const __m256i*) (cards + k));
+        idx = _mm256_i32gather_epi32((const int*) row, idx, 2);
+        _mm256_storeu_si256((__m256i*) (out + k), _mm256_and_si256(idx, mask));
+    }
+    third_batch_table_scalar(row, cards + k, len - k, out + k);
+}
+
+__attribute__((target("avx2")))
+static void third_batch_packed_avx2(uint32_t c, const uint32_t* codes, const int* cards, int len, int* out, int n) {
+    const int* bi = (const int*) packed_byte_index;
+    __m256i low = _mm256_set1_epi32(0xffff), byte = _mm256_set1_epi32(0xff);
+    __m256i u1 = _mm256_set1_epi32(c & 0xffff), u2 = _mm256_set1_epi32(c >> 16);
+    __m256i u0 = _mm256_andnot_si256(_mm256_or_si256(u1, u2), low);
+    __m256i v, v1, v2, v0, w1, w2, res;
+    int k;
+
+    for (k = 0; k + 8 <= len; k += 8) {
+        v = _mm256_i32gather_epi32((const int*) codes, _mm256_loadu_si256((const __m256i*) (cards + k)), 4);
+        v1 = _mm256_and_si256(v, low);
+        v2 = _mm256_srli_epi32(v, 16);
+        v0 = _mm256_andnot_si256(_mm256_or_si256(v1, v2), low);
+        w1 = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(u1, v1), _mm256_and_si256(u0, v2)),
+            _mm256_and_si256(u2, v0));
+        w2 = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(u2, v2), _mm256_and_si256(u0, v1)),
+            _mm256_and_si256(u1, v0));
+
+        // Base-3 value of each byte of the planes, weighted by 2 for the 2-plane
+        res = _mm256_add_epi32(_mm256_i32gather_epi32(bi, _mm256_and_si256(w1, byte), 4),
+            _mm256_slli_epi32(_mm256_i32gather_epi32(bi, _mm256_and_si256(w2, byte), 4), 1));
+        if (n > 8) {
+            v = _mm256_add_epi32(_mm256_i32gather_epi32(bi, _mm256_srli_epi32(w1, 8), 4),
+                _mm256_slli_epi32(_mm256_i32gather_epi32(bi, _mm256_srli_epi32(w2, 8), 4), 1));
+            res = _mm256_add_epi32(res, _mm256_mullo_epi32(v, _mm256_set1_epi32(6561)));
+        }
+        _mm256_storeu_si256((__m256i*) (out + k), res);
+    }
+    third_batch_packed_scalar(c, codes, cards + k, len - k, out + k, n);
+}
+
+#endif
+
+static void (*third_batch_table)(const uint16_t* row, const int* cards, int len, int* out)
+    = third_batch_table_scalar;
+static void (*third_batch_packed)(uint32_t c, const uint32_t* codes, const int* cards, int len, int* out, int n)
+    = third_batch_packed_scalar;
+
+// Selects the fastest implementation supported by the CPU (returns its name)
+static const char* third_batch_init(bool allow_simd) {
+#if THIRD_BATCH_X86
+    __builtin_cpu_init();
+    if (allow_simd && __builtin_cpu_supports("avx2")) {
+        third_batch_table = third_batch_table_avx2;
+        third_batch_packed = third_batch_packed_avx2;
+        return "avx2";
+    }
+#endif
+    third_batch_table = third_batch_table_scalar;
+    third_batch_packed = third_batch_packed_scalar;
+    return "scalar";
+}
+
+#endif
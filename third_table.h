@@ -0,0 +1,88 @@
+/*
+Precomputed third-point table, shared by greedy_cap_sets.c and all/all_caps.c.
+
+For n <= THIRD_TABLE_MAX_N, the whole 3^n x 3^n table of third(i, j) fits in uint16
+(86 MB at n=8), so every third() becomes a single load.
+The table is generated on first use and written to THIRD_TABLE_DIR/third_n<n>.bin,
+then memory-mapped read-only, so later runs (and concurrent processes) share one copy
+through the page cache instead of regenerating it.
+The file is written under a temporary name and renamed into place, so a reader never
+maps a partially written table.
+*/
+
+#ifndef THIRD_TABLE_H
+#define THIRD_TABLE_H
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "packed_card.h"
+
+#define THIRD_TABLE_MAX_N 8
+#define THIRD_TABLE_DIR "tables"
+
+// Writes the table for n dimensions to path (packed_init() must have been called)
+static int third_table_write(const char* path, int n, long tn) {
+    char tmp_path[288];
+    uint16_t* row = (uint16_t*) malloc(tn * sizeof(uint16_t));
+    packed_card c;
+    long i, j;
+    FILE* fptr;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp%ld", path, (long) getpid());
+    fptr = fopen(tmp_path, "wb");
+    if (!fptr) {
+        free(row);
+        return -1;
+    }
+
+    for (i = 0; i < tn; i++) {
+        c = packed_from_index(i);
+        for (j = 0; j < tn; j++)
+            row[j] = packed_index(packed_third(c, packed_from_index(j)), n);
+        fwrite(row, sizeof(uint16_t), tn, fptr);
+    }
+    free(row);
+
+    if (fflush(fptr) != 0 || fsync(fileno(fptr)) != 0 || fclose(fptr) != 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return rename(tmp_path, path);
+}
+
+// Returns the table for n dimensions (third(i, j) is at i*3^n + j), generating it if needed,
+// or NULL if n is too large or the table is unavailable, in which case third() must be computed
+static const uint16_t* third_table_open(int n) {
+    char path[256];
+    long tn = 1, size;
+    int i, fd;
+    struct stat st;
+    void* res;
+
+    if (n > THIRD_TABLE_MAX_N)
+        return NULL;
+    for (i = 0; i < n; i++)
+        tn *= 3;
+    size = tn * tn * (long) sizeof(uint16_t);
+
+    snprintf(path, sizeof(path), "%s/third_n%d.bin", THIRD_TABLE_DIR, n);
+    if (stat(path, &st) != 0 || st.st_size != size) {
+        mkdir(THIRD_TABLE_DIR, 0755);
+        if (third_table_write(path, n, tn) != 0)
+            return NULL;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    res = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return res == MAP_FAILED ? NULL : (const uint16_t*) res;
+}
+
+#endif